@@ -0,0 +1,330 @@
+// -------------------------------------------------------------------------
+//
+// aot8080 - ahead-of-time translator of CP/M .COM programs to C
+//
+// usage: aot8080 PROGRAM.COM... > aot.c
+//        aot8080 -m PROGRAM.COM > module.c
+//
+// Disassembles every program by recursive descent from 0100H, using the
+// same modes[] and instruction_length[] tables as the emulator, and writes
+// one C function per program. The result is compiled into the emulator with
+// -DAOT (make atari8080-aot). When the CCP starts a program at 0100H and its
+// image matches one of the translations byte for byte, the emulator runs
+// the native code instead of interpreting it.
+//
+// With -m, the output is a module for the translation cache of the emulator
+// instead. It includes atari8080.c itself, compiled with -DAOT_MODULE, and
+// is built as a shared object that exports aot_module.
+//
+// Reachable code is split in blocks at every jump target and return
+// address. Jumps between blocks are gotos, RET and PCHL go through a switch
+// on the new PC. Everything else is left to the interpreter, which is also
+// where we return to when we leave the program, like CALL 5 for BDOS:
+//
+//      * jumps and calls to addresses outside the program, or into the
+//        middle of an instruction we decoded before
+//      * HLT, IN, OUT and undefined opcodes, so BIOS and BDOS traps still
+//        end up in bios_entry() and bdos_entry()
+//      * blocks that have been written to (self-modifying code, or data
+//        that we took for code). The emulator keeps a map of which block
+//        every translated byte belongs to, and mem_write() marks the block
+//        as bad. Native code checks for that after every store.
+//
+// -------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "tables/tables.h"
+#include "tables/snippets.h"
+
+#define TPA     0x0100
+#define MAXLEN  (0xe400 - TPA)          // up to the CCP
+
+struct program {
+    char name[16];
+    uint8_t image[MAXLEN];
+    int len;
+    uint8_t seen[MAXLEN];               // queued for decoding
+    uint8_t insn[MAXLEN];               // an instruction starts here
+    uint8_t owned[MAXLEN];              // part of a decoded instruction
+    uint8_t leader[MAXLEN];             // a block starts here
+    int block[MAXLEN];
+    int nblocks;
+};
+
+static int queue[MAXLEN], nqueue;
+
+static int inside(struct program *p, int adr) {
+    return adr >= TPA && adr < TPA + p->len;
+}
+
+static int is_insn(struct program *p, int adr) {
+    return inside(p, adr) && p->insn[adr-TPA];
+}
+
+static void enqueue(struct program *p, int adr, int leader) {
+    if (!inside(p, adr))
+        return;
+    if (leader)
+        p->leader[adr-TPA] = 1;
+    if (!p->seen[adr-TPA]) {
+        p->seen[adr-TPA] = 1;
+        queue[nqueue++] = adr;
+    }
+}
+
+// -------------------------------------------------------------------------
+
+static void analyze(struct program *p) {
+    enqueue(p, TPA, 1);
+
+    while (nqueue) {
+        int adr = queue[--nqueue];
+        int o = p->image[adr-TPA];
+        int len = instruction_length[o];
+        int next = adr + len;
+        int target = 0;
+
+        if (next > TPA + p->len)
+            continue;                   // runs off the end of the image
+
+        int clash = 0;
+        for (int i=0; i<len; i++)
+            clash |= p->owned[adr-TPA+i];
+        if (clash)
+            continue;                   // overlaps, leave it to the interpreter
+
+        p->insn[adr-TPA] = 1;
+        for (int i=0; i<len; i++)
+            p->owned[adr-TPA+i] = 1;
+
+        if (len == 3)
+            target = p->image[adr-TPA+1] | (p->image[adr-TPA+2] << 8);
+
+        if (kind[o] == NONE) {
+            if (o != 0x76 && strcmp(mnemonics[o], "UNDEFINED"))
+                enqueue(p, next, 1);    // IN/OUT, interpreter comes back here
+        } else if (o == 0xc3) {                     // JMP
+            enqueue(p, target, 1);
+        } else if ((o & 0xc7) == 0xc2) {            // Jcc
+            enqueue(p, target, 1);
+            enqueue(p, next, 0);
+        } else if (o == 0xcd || (o & 0xc7) == 0xc4) { // CALL, Ccc
+            enqueue(p, target, 1);
+            enqueue(p, next, 1);
+        } else if ((o & 0xc7) == 0xc7) {            // RST
+            enqueue(p, next, 1);
+        } else if (o == 0xc9 || o == 0xe9) {        // RET, PCHL
+            ;
+        } else {                                    // Rcc and the rest
+            enqueue(p, next, 0);
+        }
+    }
+
+    p->nblocks = 0;
+    int cur = -1;
+    for (int i=0; i<p->len; i++) {
+        if (p->insn[i] && p->leader[i])
+            cur = p->nblocks++;
+        else if (p->insn[i] && cur < 0)
+            cur = p->nblocks++;
+        if (p->insn[i]) {
+            int len = instruction_length[p->image[i]];
+            for (int j=0; j<len; j++)
+                p->block[i+j] = cur;
+        } else if (!p->owned[i]) {
+            p->block[i] = -1;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------
+
+static void emit_goto(struct program *p, int target) {
+    if (is_insn(p, target) && p->leader[target-TPA])
+        printf("goto L_%04x;", target);
+    else
+        printf("AOT_EXIT(0x%04x);", target);
+}
+
+static void emit_call(struct program *p, int next, int target) {
+    printf("PUSH(0x%02x, 0x%02x); if (aot_smc) AOT_EXIT(0x%04x); ",
+                                        next >> 8, next & 0xff, target);
+    emit_goto(p, target);
+}
+
+static void emit_program(struct program *p) {
+    printf("// %s, %d bytes, %d blocks\n\n", p->name, p->len, p->nblocks);
+
+    printf("static const uint8_t aot_image_%s[%d] = {", p->name, p->len);
+    for (int i=0; i<p->len; i++)
+        printf("%s0x%02x,", i%12 ? " " : "\n    ", p->image[i]);
+    printf("\n};\n\n");
+
+    printf("static const uint16_t aot_blocks_%s[%d] = {", p->name, p->len);
+    for (int i=0; i<p->len; i++)
+        printf("%s%d,", i%16 ? " " : "\n    ",
+                                p->owned[i] ? p->block[i] + 1 : 0);
+    printf("\n};\n\n");
+
+    printf("static uint8_t aot_bad_%s[%d];\n\n", p->name, p->nblocks);
+
+    printf("static void aot_run_%s(void) {\n", p->name);
+    printf("    int16_t z;\n");
+    printf("    uint8_t t8, M, byte2, byte3;\n");
+    printf("    int32_t t32;\n");
+    printf("    uint16_t u16, hl;\n\n");
+    printf("    aot_smc = 0;\n");
+    printf("    goto aot_dispatch;\n\n");
+
+    for (int adr=TPA; adr<TPA+p->len; adr++) {
+        if (!is_insn(p, adr))
+            continue;
+
+        int o = p->image[adr-TPA];
+        int len = instruction_length[o];
+        int next = adr + len;
+        int b2 = len > 1 ? p->image[adr-TPA+1] : 0;
+        int b3 = len > 2 ? p->image[adr-TPA+2] : 0;
+        int target = b2 | (b3 << 8);
+        int falls = 1;
+
+        if (p->leader[adr-TPA])
+            printf("L_%04x: if (aot_bad_%s[%d]) AOT_EXIT(0x%04x);\n",
+                            adr, p->name, p->block[adr-TPA], adr);
+
+        printf("    // %04x  %s", adr, mnemonics[o]);
+        if (len == 2) printf(" %02XH", b2);
+        if (len == 3) printf(" %04XH", target);
+        printf("\n    ");
+
+        if (len > 1) printf("byte2 = 0x%02x; ", b2);
+        if (len > 2) printf("byte3 = 0x%02x; ", b3);
+        if (kind[o] != NONE) printf("AOT_COUNT(); ");
+
+        if (kind[o] == NONE) {
+            printf("AOT_EXIT(0x%04x);", adr);
+            falls = 0;
+        } else if (kind[o] != BRANCH) {
+            printf("%s", code[o]);
+            if (kind[o] == WRITE)
+                printf(" if (aot_smc) AOT_EXIT(0x%04x);", next);
+        } else if (o == 0xc3) {
+            emit_goto(p, target);
+            falls = 0;
+        } else if ((o & 0xc7) == 0xc2) {
+            printf("if (%s) ", cond[(o>>3)&7]);
+            emit_goto(p, target);
+        } else if (o == 0xcd) {
+            emit_call(p, next, target);
+            falls = 0;
+        } else if ((o & 0xc7) == 0xc4) {
+            printf("if (%s) { ", cond[(o>>3)&7]);
+            emit_call(p, next, target);
+            printf(" }");
+        } else if ((o & 0xc7) == 0xc7) {
+            emit_call(p, next, o & 0x38);
+            falls = 0;
+        } else if (o == 0xc9) {
+            printf("POP(PCH,PCL); goto aot_dispatch;");
+            falls = 0;
+        } else if ((o & 0xc7) == 0xc0) {
+            printf("if (%s) { POP(PCH,PCL); goto aot_dispatch; }",
+                                                    cond[(o>>3)&7]);
+        } else if (o == 0xe9) {
+            printf("PCHL(); goto aot_dispatch;");
+            falls = 0;
+        }
+        printf("\n");
+
+        if (falls && !is_insn(p, next))
+            printf("    AOT_EXIT(0x%04x);\n", next);
+    }
+
+    printf("\naot_dispatch:\n");
+    printf("    switch ((PCH<<8) | PCL) {\n");
+    for (int adr=TPA; adr<TPA+p->len; adr++)
+        if (is_insn(p, adr) && p->leader[adr-TPA])
+            printf("    case 0x%04x: goto L_%04x;\n", adr, adr);
+    printf("    default: break;\n");
+    printf("    }\n");
+    printf("    PCHa = PCH & 0x3f;\n");
+    printf("    curbank = PCH>>6;\n");
+    printf("}\n\n");
+}
+
+// -------------------------------------------------------------------------
+
+static int load(struct program *p, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "aot8080: unable to open %s\n", path);
+        return -1;
+    }
+    p->len = fread(p->image, 1, MAXLEN, f);
+    fclose(f);
+    if (!p->len) {
+        fprintf(stderr, "aot8080: %s is empty\n", path);
+        return -1;
+    }
+
+    const char *base = strrchr(path, '/');
+    base = base ? base+1 : path;
+    int i;
+    for (i=0; base[i] && base[i] != '.' && i<(int)sizeof(p->name)-1; i++)
+        p->name[i] = isalnum((unsigned char) base[i]) ?
+                                toupper((unsigned char) base[i]) : '_';
+    p->name[i] = 0;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int module = argc == 3 && !strcmp(argv[1], "-m");
+
+    if (argc < 2 || (!module && !strcmp(argv[1], "-m"))) {
+        fprintf(stderr, "usage: aot8080 PROGRAM.COM... > aot.c\n"
+                        "       aot8080 -m PROGRAM.COM > module.c\n");
+        return 1;
+    }
+
+    build_snippets();
+
+    printf("// Generated by aot8080, do not edit.\n\n");
+    if (module)
+        printf("#define AOT\n#define AOT_MODULE\n#include \"atari8080.c\"\n\n");
+
+    struct program *progs[argc];
+    for (int i=1+module; i<argc; i++) {
+        progs[i] = calloc(1, sizeof(struct program));
+        if (!progs[i] || load(progs[i], argv[i]) < 0)
+            return 1;
+        analyze(progs[i]);
+        emit_program(progs[i]);
+        if (!module)
+            fprintf(stderr, "aot8080: %s: %d bytes, %d blocks\n",
+                            progs[i]->name, progs[i]->len, progs[i]->nblocks);
+    }
+
+    if (module) {
+        struct program *p = progs[2];
+        printf("const struct aot_module aot_module = { AOT_ABI, 0x%04x,\n"
+               "    { \"%s\", aot_image_%s, aot_blocks_%s, aot_bad_%s, "
+               "%d, %d, aot_run_%s }\n};\n", TPA, p->name, p->name,
+               p->name, p->name, p->len, p->nblocks, p->name);
+        return 0;
+    }
+
+    printf("static const struct aot_program aot_programs[] = {\n");
+    for (int i=1; i<argc; i++)
+        printf("    { \"%s\", aot_image_%s, aot_blocks_%s, aot_bad_%s, "
+               "%d, %d, aot_run_%s },\n", progs[i]->name, progs[i]->name,
+               progs[i]->name, progs[i]->name, progs[i]->len,
+               progs[i]->nblocks, progs[i]->name);
+    printf("};\n");
+
+    return 0;
+}
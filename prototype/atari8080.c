@@ -25,6 +25,21 @@
 #include <string.h>
 #include <errno.h>
 #include <termios.h>
+#include <time.h>
+#include <signal.h>
+#include <ctype.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <dirent.h>
+
+#ifdef AOT
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
 
 // Sources:
 //      * Intel 8080 Programmers Manual
@@ -52,205 +67,2502 @@
 // zendif
 //      // done
 
-static uint8_t mem[4][16384];
-static uint8_t curbank;
+// Machine state that translated code loaded at run time shares with the
+// emulator, see aot_cache_load(). Such a module is this file compiled with
+// -DAOT_MODULE, so it refers to our copy instead of having its own.
+
+#if defined(AOT_MODULE)
+#define SHARED  extern
+#elif defined(AOT)
+#define SHARED
+#else
+#define SHARED  static
+#endif
+
+SHARED uint8_t mem[4][16384] __attribute__((aligned(4096)));  // host pages
+SHARED uint8_t curbank;
+
+// 8080 registers on page zero.
+//
+// Atari: keep PC always adjusted. BC, DE, HL and SP only when needed. The
+// latter is not used in this C implementation, but on the Atari we could
+// implement four different functions for dereferencing BC, DE, HL or SP,
+// avoiding the need to copy the low byte.
+//
+// That layout is built with -DATARI_REGS, to model the 6502 version. By
+// default the pairs are host words with their bytes on top, so that LXI,
+// INX, DAD, PUSH, POP and the like are one 16-bit operation instead of two
+// bytes and a carry.
+
+#ifdef ATARI_REGS
+
+SHARED struct __attribute__((packed, aligned(1))) zp {
+    uint8_t A;
+
+    uint8_t B;
+    uint8_t C;
+    uint8_t B_adjusted;     // atari: (BC) ---> lda (C),y after adjust
+
+    uint8_t D;
+    uint8_t E;
+    uint8_t D_adjusted;
+
+    uint8_t H;
+    uint8_t L;
+    uint8_t H_adjusted;
+
+    uint8_t SPH;
+    uint8_t SPL;
+    uint8_t SPH_adjusted;
+
+    uint8_t PCH;
+    uint8_t PCL;
+    uint8_t PCH_adjusted;
+} zp;
+
+#define Ba      zp.B_adjusted
+#define Da      zp.D_adjusted
+#define Ha      zp.H_adjusted
+#define SPHa    zp.SPH_adjusted
+
+#else
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_PAIR(XY, X, Y)  union { uint16_t XY; struct { uint8_t X, Y; }; }
+#else
+#define REG_PAIR(XY, X, Y)  union { uint16_t XY; struct { uint8_t Y, X; }; }
+#endif
+
+SHARED struct zp {
+    uint8_t A;
+    uint8_t PCH_adjusted;
+    REG_PAIR(BC, B, C);
+    REG_PAIR(DE, D, E);
+    REG_PAIR(HL, H, L);
+    REG_PAIR(SP, SPH, SPL);
+    REG_PAIR(PC, PCH, PCL);
+} zp;
+
+#define BC      zp.BC
+#define DE      zp.DE
+#define HL      zp.HL
+#define SP      zp.SP
+#define PC      zp.PC
+
+#define SPHSPL  SP                  // for the opcode macros, which paste
+#define PCHPCL  PC                  // X##Y
+
+#endif
+
+#define A       zp.A
+
+#define B       zp.B
+#define C       zp.C
+
+#define D       zp.D
+#define E       zp.E
+
+#define H       zp.H
+#define L       zp.L
+
+#define SPH     zp.SPH
+#define SPL     zp.SPL
+
+#define PCH     zp.PCH
+#define PCL     zp.PCL
+#define PCHa    zp.PCH_adjusted
+
+// PSW bits separate
+//
+// |S|Z|0|A|0|P|1|C|
+
+#define SF_FLAG     0b10000000
+#define ZF_FLAG     0b01000000
+#define AF_FLAG     0b00010000
+#define PF_FLAG     0b00000100
+#define ONE_FLAG    0b00000010      // always set!
+#define CF_FLAG     0b00000001
+
+SHARED uint8_t F;                   // ONE_FLAG is set in main()
+
+#define ALL_FLAGS   (SF_FLAG | ZF_FLAG | AF_FLAG | PF_FLAG | ONE_FLAG | CF_FLAG)
+
+// Used during instruction fetch
+
+static uint8_t instruction, byte2, byte3;
+
+// used during memory access
+
+#define byte1 instruction
+
+// Assemble CCP.SYS and BDOS.SYS from https://github.com/brouhaha/cpm22
+// Assembler: http://john.ccac.rwth-aachen.de:8000/as/
+//
+// Standard CP/M Memory layout:
+//
+// $E400 = CCP      (important: disable serialization!)
+// $EC00 = BDOS     (entry at $EC06)
+// $FA00 = BIOS
+//
+// Trap BIOS calls with an unused 8080 instruction and use C functions
+// to mimic its functions.
+
+#define BIOS    0xfa00
+
+#define BDOS    0xec00
+#define BDOSJMP (BDOS+6)
+#define BDOSE   (BDOS+0x11)
+
+#define CPMB    0xe400          // base of cpm console processor
+
+#define BOOTF   (BIOS+3*0)     // cold boot
+#define WBOOTF  (BIOS+3*1)     // warm boot
+#define CONSTF  (BIOS+3*2)     // console status, A=0 no char, A=ff char
+#define CONINF  (BIOS+3*3)     // console input, result in A
+#define CONOUTF (BIOS+3*4)     // console output, char in C
+#define LISTF   (BIOS+3*5)     // list output (ignore)
+#define PUNCHF  (BIOS+3*6)     // punch output (ignore)
+#define READERF (BIOS+3*7)     // reader input (ignore, return A=^Z)
+#define HOMEF   (BIOS+3*8)     // disk home (set track 0)
+#define SELDSKF (BIOS+3*9)     // select disk (disk in C, return HL=dpbase or 0)
+#define SETTRKF (BIOS+3*10)    // set track (track in C)
+#define SETSECF (BIOS+3*11)    // set sector (sector in BC or C)
+#define SETDMAF (BIOS+3*12)    // set dma (default=$80, input in BC)
+#define READF   (BIOS+3*13)    // read record (return error in A, A=0=OK)
+#define WRITEF  (BIOS+3*14)    // write record (return error in A, A=0=OK)
+#define LISTSTF (BIOS+3*15)    // list status (ignore) (A=0=not ready)
+#define SECTRAN (BIOS+3*16)    // sector translate (in BC, out in HL)
+
+#define DPBASE  (BIOS + 17*3)  // see below
+
+// -------------------------------------------------------------------------
+
+#include "tables/tables.h"
+#include "overlay.h"
+#include "store.c"
+#ifdef LOCKSTEP                     // one copy for each machine
+#define LOCKSTEP_FN(prefix, name)   LOCKSTEP_FN_(prefix, name)
+#define LOCKSTEP_FN_(prefix, name)  prefix##_##name
+#define bios_sys        LOCKSTEP_FN(LOCKSTEP, bios_sys)
+#define bios_sys_len    LOCKSTEP_FN(LOCKSTEP, bios_sys_len)
+#define bdos_sys        LOCKSTEP_FN(LOCKSTEP, bdos_sys)
+#define bdos_sys_len    LOCKSTEP_FN(LOCKSTEP, bdos_sys_len)
+#define ccp_sys         LOCKSTEP_FN(LOCKSTEP, ccp_sys)
+#define ccp_sys_len     LOCKSTEP_FN(LOCKSTEP, ccp_sys_len)
+#endif
+#include "cpm22/bios.h"
+#include "cpm22/bdos.h"
+#include "cpm22/ccp.h"
+
+#ifdef SUPEROPS
+#define SUPEROP_TABLE           // only superop_first[] at this point
+#include "tables/superops.h"
+#undef SUPEROP_TABLE
+#endif
+
+// -------------------------------------------------------------------------
+
+// Tons of debug output. Might cut down on it a little.
+
+#ifdef BIOSDEBUG
+#define biosprintf(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define biosprintf(...)
+#endif
+
+#ifdef DEBUG
+
+static int cpudump = 0, wbootcnt = 0;
+
+static void debug_print_cpu_state(void) {
+    if (cpudump) {
+    fprintf(stderr, "PC:%02X%02X A:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X "
+           "SP:%02X%02X ", PCH, PCL, A, B, C, D, E, H, L, SPH, SPL);
+    fprintf(stderr, "S:%d Z:%d A:%d P:%d C:%d // F:%02x\n", !!F&SF_FLAG, !!F&ZF_FLAG, !!F&AF_FLAG, !!F&PF_FLAG, !!F&CF_FLAG, F);
+    }
+}
+
+static void debug_print_instruction(void) {
+    if (cpudump) {
+    fprintf(stderr, ">>> %s ", mnemonics[instruction]);
+    int mode = modes[instruction];
+    switch (mode) {
+    case MODE_D8:   fprintf(stderr, "%02XH", byte2);   break;
+    case MODE_D16:
+    case MODE_ADR:
+    case MODE_JMP:  fprintf(stderr, "%02X%02XH", byte3, byte2); break;
+    default:        break;
+    }
+    fprintf(stderr, "\n");
+    }
+}
+
+#else
+
+#define debug_print_cpu_state()
+#define debug_print_instruction()
+
+#endif
+
+#ifdef PROFILE
+
+// Execution profile. Counts opcodes, and sequences of two and three opcodes
+// that were executed back to back without a jump in between. Those are the
+// candidates for fused handlers, see tables/superopgen.c. Written at exit to
+// the file named by ATARI8080_PROFILE, or atari8080.prof.
+
+#define PROF_TRIPLES    (1<<18)             // open addressing, power of two
+
+static uint64_t prof_ops[256];
+static uint64_t prof_pairs[256*256];
+static struct { uint32_t key; uint64_t count; } prof_triples[PROF_TRIPLES];
+static int prof_ntriples, prof_prev = -1, prof_prev2 = -1;
+static uint16_t prof_nextpc;
+
+static void profile_instruction(uint16_t pc) {
+    if (pc != prof_nextpc)                  // jumped, sequence is broken
+        prof_prev = prof_prev2 = -1;
+
+    prof_ops[instruction]++;
+
+    if (prof_prev >= 0) {
+        prof_pairs[(prof_prev<<8) | instruction]++;
+    }
+    if (prof_prev2 >= 0) {
+        uint32_t key = (prof_prev2<<16) | (prof_prev<<8) | instruction;
+        uint32_t h = ((key * 2654435761u) >> 14) & (PROF_TRIPLES-1);
+        while (prof_triples[h].count && prof_triples[h].key != key)
+            h = (h+1) & (PROF_TRIPLES-1);
+        if (prof_triples[h].count) {
+            prof_triples[h].count++;
+        } else if (prof_ntriples < PROF_TRIPLES/4*3) {  // keep probing short
+            prof_triples[h].key = key;
+            prof_triples[h].count = 1;
+            prof_ntriples++;
+        }
+    }
+
+    prof_prev2 = prof_prev;
+    prof_prev = instruction;
+    prof_nextpc = pc + instruction_length[instruction];
+}
+
+static void profile_dump(void) {
+    char *name = getenv("ATARI8080_PROFILE");
+    FILE *f = fopen(name ? name : "atari8080.prof", "w");
+    if (!f) return;
+
+    fprintf(f, "# atari8080 execution profile\n");
+    for (int i=0; i<256; i++)
+        if (prof_ops[i])
+            fprintf(f, "op %02x %llu\n", i, (unsigned long long) prof_ops[i]);
+    for (int i=0; i<256*256; i++)
+        if (prof_pairs[i])
+            fprintf(f, "pair %04x %llu\n", i,
+                                    (unsigned long long) prof_pairs[i]);
+    for (int i=0; i<PROF_TRIPLES; i++)
+        if (prof_triples[i].count)
+            fprintf(f, "triple %06x %llu\n", prof_triples[i].key,
+                                    (unsigned long long) prof_triples[i].count);
+    fclose(f);
+}
+
+#else
+
+#define profile_instruction(pc)
+
+#endif
+
+#ifdef CALLPROF
+
+// Call graph profile. CALL and RST push a frame on a shadow stack, RET pops
+// it, and every instruction is counted in the calling context it runs in.
+// Frames are matched on the address of their return address on the 8080
+// stack, not on the return address itself, so a return through XTHL still
+// pops its frame. A RET from a slot that is deeper on the shadow stack pops
+// the frames above it, too, which cleans up after routines that returned
+// with POP H ; PCHL. A RET that matches no frame, like PUSH H ; RET, or
+// one on a stack that was switched by SPHL (BDOS does that), pops nothing.
+//
+// Written at exit to the file named by ATARI8080_CALLPROF, or
+// atari8080.folded, in collapsed stack format for flamegraph.pl. Symbols
+// are read from the listings (.PRN) or symbol files (.SYM) in
+// ATARI8080_SYMBOLS, separated by colons.
+
+#define CP_NODES    (1<<16)             // calling contexts
+#define CP_HASH     (1<<17)             // open addressing, power of two
+#define CP_DEPTH    256
+
+static struct { int parent; uint16_t adr; uint64_t count; } cp_nodes[CP_NODES];
+static int cp_hash[CP_HASH];            // node+1
+static int cp_nnodes = 1;               // 0 is the root
+static struct { int node; uint16_t sp; } cp_stack[CP_DEPTH];
+static int cp_depth, cp_current;
+
+static struct { uint16_t adr; char name[24]; } *cp_syms;
+static int cp_nsyms;
+
+static int cp_child(int parent, uint16_t adr) {
+    uint32_t key = (parent << 16) | adr;
+    uint32_t h = ((key * 2654435761u) >> 13) & (CP_HASH-1);
+
+    while (cp_hash[h]) {
+        int n = cp_hash[h] - 1;
+        if (cp_nodes[n].parent == parent && cp_nodes[n].adr == adr)
+            return n;
+        h = (h+1) & (CP_HASH-1);
+    }
+    if (cp_nnodes == CP_NODES)
+        return parent;                  // full, count it in the caller
+    int n = cp_nnodes++;
+    cp_nodes[n].parent = parent;
+    cp_nodes[n].adr = adr;
+    cp_hash[h] = n + 1;
+    return n;
+}
+
+static void callprof_unwind(uint16_t sp) {
+    for (int i=cp_depth-1; i>=0; i--) {
+        if (cp_stack[i].sp == sp) {
+            cp_depth = i;
+            break;
+        }
+    }
+    cp_current = cp_depth ? cp_stack[cp_depth-1].node : 0;
+}
+
+// Called after the return address is pushed.
+
+static void callprof_call(uint16_t target) {
+    uint16_t sp = (SPH<<8) | SPL;
+
+    callprof_unwind(sp);                // a frame we jumped out of
+    if (cp_depth == CP_DEPTH)
+        return;
+    cp_current = cp_child(cp_current, target);
+    cp_stack[cp_depth].node = cp_current;
+    cp_stack[cp_depth].sp = sp;
+    cp_depth++;
+}
+
+// Called before the return address is popped.
+
+static void callprof_ret(void) {
+    callprof_unwind((SPH<<8) | SPL);
+}
+
+static void callprof_reset(void) {
+    cp_depth = cp_current = 0;
+}
+
+#define callprof_instruction()  cp_nodes[cp_current].count++
+
+static void callprof_add_symbol(uint16_t adr, const char *name, int len) {
+    if (len <= 0 || name[0] == '.')     // M80 local labels, like ..0001
+        return;
+    cp_syms = realloc(cp_syms, (cp_nsyms+1) * sizeof(*cp_syms));
+    cp_syms[cp_nsyms].adr = adr;
+    snprintf(cp_syms[cp_nsyms].name, sizeof(cp_syms[0].name), "%.*s",
+                                                                len, name);
+    cp_nsyms++;
+}
+
+static int ishexword(const char *s) {
+    for (int i=0; i<4; i++)
+        if (!isxdigit((unsigned char) s[i])) return 0;
+    return 1;
+}
+
+// Three formats: the "Symbols:" table at the end of an M80 listing, .SYM
+// files with the same "0100 NAME" pairs, and ASM listings, where a line
+// like " 0100 C3B201    START:  JMP ..." defines START.
+
+static void callprof_read_symbols(const char *file) {
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", file);
+        return;
+    }
+
+    const char *ext = strrchr(file, '.');
+    int table = ext && !strcasecmp(ext, ".sym");
+    char line[256];
+
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, "Symbols:")) {
+            table = 1;
+            continue;
+        }
+        if (table) {
+            char *p = line;
+            while (*p) {
+                while (isspace((unsigned char) *p)) p++;
+                if (!ishexword(p) || isxdigit((unsigned char) p[4]))
+                    break;
+                uint16_t adr = strtol(p, NULL, 16);
+                p += 4;
+                while (*p && !isspace((unsigned char) *p)) p++; // ' or "
+                while (isspace((unsigned char) *p)) p++;
+                int len = strcspn(p, " \t\r\n");
+                callprof_add_symbol(adr, p, len);
+                p += len;
+            }
+        } else if (line[0] == ' ' && ishexword(line+1) && strlen(line) > 16) {
+            char *p = line + 16;
+            int len = strcspn(p, ": \t\r\n");
+            if (p[len] == ':' && isalpha((unsigned char) p[0]))
+                callprof_add_symbol(strtol(line+1, NULL, 16), p, len);
+        }
+    }
+    fclose(f);
+}
+
+static void callprof_print_name(FILE *f, uint16_t adr) {
+    static const char *bios[] = {
+        "BOOT", "WBOOT", "CONST", "CONIN", "CONOUT", "LIST", "PUNCH",
+        "READER", "HOME", "SELDSK", "SETTRK", "SETSEC", "SETDMA", "READ",
+        "WRITE", "LISTST", "SECTRAN"
+    };
+
+    for (int i=0; i<cp_nsyms; i++) {
+        if (cp_syms[i].adr == adr) {
+            fprintf(f, "%s", cp_syms[i].name);
+            return;
+        }
+    }
+    if (adr == 0x0005)
+        fprintf(f, "BDOS");
+    else if (adr >= BIOS && adr < BIOS+17*3 && (adr-BIOS) % 3 == 0)
+        fprintf(f, "BIOS_%s", bios[(adr-BIOS)/3]);
+    else if (adr >= BIOS)
+        fprintf(f, "BIOS_%04X", adr);
+    else if (adr >= BDOS)
+        fprintf(f, "BDOS_%04X", adr);
+    else if (adr >= CPMB)
+        fprintf(f, "CCP_%04X", adr);
+    else
+        fprintf(f, "%04X", adr);
+}
+
+static void callprof_print_path(FILE *f, int n) {
+    if (n == 0) {
+        fprintf(f, "cpm");
+        return;
+    }
+    callprof_print_path(f, cp_nodes[n].parent);
+    fprintf(f, ";");
+    callprof_print_name(f, cp_nodes[n].adr);
+}
+
+static void callprof_dump(void) {
+    char *name = getenv("ATARI8080_CALLPROF");
+    char *syms = getenv("ATARI8080_SYMBOLS");
+
+    if (syms) {
+        char *s = strdup(syms);
+        for (char *t = strtok(s, ":"); t; t = strtok(NULL, ":"))
+            callprof_read_symbols(t);
+        free(s);
+    }
+
+    FILE *f = fopen(name ? name : "atari8080.folded", "w");
+    if (!f) return;
+
+    for (int i=0; i<cp_nnodes; i++) {
+        if (!cp_nodes[i].count)
+            continue;
+        callprof_print_path(f, i);
+        fprintf(f, " %llu\n", (unsigned long long) cp_nodes[i].count);
+    }
+    fclose(f);
+}
+
+#else
+
+#define callprof_call(target)
+#define callprof_ret()
+#define callprof_reset()
+#define callprof_instruction()
+
+#endif
+
+#ifdef COVERAGE
+
+// Coverage and memory heat map. Keeps a bitmap of every address an
+// instruction was fetched from, read and write counts for every 256-byte
+// page, and how often the Atari would have to switch banks: for the
+// instruction fetcher when the PC moves to another 16kB bank, and for data
+// access to a bank other than the one the fetcher has switched in.
+// Written at exit as JSON to the file named by ATARI8080_COVERAGE, or
+// atari8080-coverage.json.
+
+static uint8_t cov_executed[65536/8];
+static uint64_t cov_ops[256];
+static uint64_t cov_reads[256], cov_writes[256];
+static uint64_t cov_fetch_switches[4], cov_data_switches[4], cov_data[4];
+static int cov_fetchbank = -1;
+
+static void coverage_instruction(uint16_t pc) {
+    cov_executed[pc>>3] |= 1 << (pc&7);
+    cov_ops[instruction]++;
+    if (pc>>14 != cov_fetchbank) {
+        cov_fetchbank = pc>>14;
+        cov_fetch_switches[cov_fetchbank]++;
+    }
+}
+
+static inline void coverage_access(uint64_t *counts, uint16_t adr,
+                                   uint8_t bank) {
+    counts[adr>>8]++;
+    cov_data[adr>>14]++;
+    if (adr>>14 != bank)
+        cov_data_switches[adr>>14]++;
+}
+
+#define coverage_read(adr, bank)    coverage_access(cov_reads, adr, bank)
+#define coverage_write(adr, bank)   coverage_access(cov_writes, adr, bank)
+
+static void coverage_print_array(FILE *f, const char *name,
+                                 const uint64_t *a, int n) {
+    fprintf(f, "  \"%s\": [", name);
+    for (int i=0; i<n; i++)
+        fprintf(f, "%s%llu", i ? (i%16 ? ", " : ",\n    ") : "\n    ",
+                                                (unsigned long long) a[i]);
+    fprintf(f, "\n  ]");
+}
+
+static void coverage_dump(void) {
+    char *name = getenv("ATARI8080_COVERAGE");
+    FILE *f = fopen(name ? name : "atari8080-coverage.json", "w");
+    if (!f) return;
+
+    int total = 0;
+    for (int i=0; i<65536; i++)
+        total += (cov_executed[i>>3] >> (i&7)) & 1;
+
+    fprintf(f, "{\n  \"executed_addresses\": %d,\n", total);
+
+    // bit n of byte m is address m*8+n
+
+    fprintf(f, "  \"executed_bitmap\": \"");
+    for (int i=0; i<65536/8; i++)
+        fprintf(f, "%02x", cov_executed[i]);
+    fprintf(f, "\",\n  \"executed_ranges\": [");
+    for (int i=0, first=1; i<65536; ) {
+        if (!((cov_executed[i>>3] >> (i&7)) & 1)) {
+            i++;
+            continue;
+        }
+        int j = i;
+        while (j < 65536 && (cov_executed[j>>3] >> (j&7)) & 1)
+            j++;
+        fprintf(f, "%s[%d, %d]", first ? "\n    " : ",\n    ", i, j-1);
+        first = 0;
+        i = j;
+    }
+    fprintf(f, "\n  ],\n");
+
+    coverage_print_array(f, "opcodes", cov_ops, 256);
+    fprintf(f, ",\n");
+    coverage_print_array(f, "page_reads", cov_reads, 256);
+    fprintf(f, ",\n");
+    coverage_print_array(f, "page_writes", cov_writes, 256);
+    fprintf(f, ",\n  \"banks\": [");
+    for (int b=0; b<4; b++)
+        fprintf(f, "%s\n    { \"bank\": %d, \"fetch_switches\": %llu, "
+                   "\"data_accesses\": %llu, \"data_switches\": %llu }",
+                   b ? "," : "", b,
+                   (unsigned long long) cov_fetch_switches[b],
+                   (unsigned long long) cov_data[b],
+                   (unsigned long long) cov_data_switches[b]);
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+}
+
+#else
+
+#define coverage_instruction(pc)
+#define coverage_read(adr, bank)
+#define coverage_write(adr, bank)
+
+#endif
+
+#ifdef AOT
+
+// Programs translated ahead of time by aot8080. The active one is the one
+// whose image was found at 0100H when the CCP jumped there. aot_block[] has
+// the block number plus one of every translated byte, so a write to it
+// marks the block bad. The native code checks aot_smc after every store and
+// returns to the interpreter if something was invalidated.
+
+struct aot_program {
+    const char *name;
+    const uint8_t *image;
+    const uint16_t *blocks;
+    uint8_t *bad;
+    int len, nblocks;
+    void (*run)(void);
+};
+
+// What a translation cache module exports as aot_module. AOT_ABI is a
+// checksum of this file, so modules built by an older emulator are not
+// used.
+
+struct aot_module {
+    unsigned long abi;
+    uint16_t load;
+    struct aot_program program;
+};
+
+SHARED const struct aot_program *aot_active;
+SHARED uint16_t aot_block[65536];
+SHARED uint8_t aot_smc;
+static uint8_t aot_page[256] = { [0x01] = 1 };   // see the next start
+static uint16_t aot_load_top;       // end of what the CCP loaded at 0100H
+
+static inline void aot_write_hook(uint16_t adr) {
+    int b = aot_block[adr];
+    if (b && !aot_active->bad[b-1]) {
+        aot_active->bad[b-1] = 1;
+        aot_smc = 1;
+    }
+}
+
+#define AOT_EXIT(adr) \
+    { PCL = (adr) & 0xff; PCH = (adr) >> 8; PCHa = PCH & 0x3f; \
+      curbank = PCH >> 6; return; }
+
+// Native code only counts its instructions for the lockstep driver, which
+// keeps the reference machine at the same count.
+
+#ifdef LOCKSTEP
+#define AOT_COUNT()     icount++
+#else
+#define AOT_COUNT()
+#endif
+
+// Remember how much was loaded by the CCP, so we know how many bytes of
+// the program to look up in the translation cache. Loading always starts
+// with a read to 0100H.
+
+static inline void aot_load_hook(uint16_t adr) {
+    if (adr == 0x0100)
+        aot_load_top = adr;
+    if (adr == aot_load_top && adr < CPMB)
+        aot_load_top = adr + 128;
+}
+
+#ifdef AOT_MODULE
+#define aot_enter()                 // modules don't run the interpreter
+#else
+static void aot_enter(void);
+#endif
+
+#else
+#define aot_write_hook(adr)
+#define aot_load_hook(adr)
+#endif
+
+static void print_bdos_serial() {
+    fprintf(stderr, "BDOS serial: ");
+    for (int i=0; i<6; i++)
+        fprintf(stderr, "%02X ", mem[3][(BDOS&0x3fff)+i]);
+    fprintf(stderr, "\n");
+}
+
+// -------------------------------------------------------------------------
+
+static void mem_write(uint8_t LOW, uint8_t HIGH, uint8_t VAL);
+static uint8_t mem_read(uint8_t LOW, uint8_t HIGH);
+static int kbhit();
+
+// Statistics, written at exit to the file named by ATARI8080_STATS, and
+// while it runs every ATARI8080_STATS_INTERVAL seconds. SIGUSR1 prints them
+// on stderr. Native code of atari8080-aot does not count its instructions.
+//
+// The signals only set run_request. The run loop checks it before every
+// instruction and returns to run_emulator(), which calls stats_requests(),
+// and so does the console while it waits for a key.
+
+static volatile sig_atomic_t run_request;      // run loop returns
+static volatile sig_atomic_t stats_print_request, stats_write_request;
+
+static uint64_t icount;
+static uint64_t bios_calls[17], bdos_calls[256];
+static uint64_t disk_read_bytes, disk_write_bytes;
+static uint64_t disk_read_ns[32], disk_write_ns[32];    // log2 histograms
+static uint64_t console_in_bytes, console_out_bytes;
+static double input_wait;                       // seconds
+static struct timespec stats_start, stats_last;
+static uint64_t stats_last_icount;
+
+static double seconds_since(struct timespec *t) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+static void latency(uint64_t *histogram, struct timespec *t) {
+    uint64_t ns = seconds_since(t) * 1e9;
+    int bucket = 0;
+
+    while (ns >>= 1)
+        bucket++;
+    histogram[bucket < 32 ? bucket : 31]++;
+}
+
+static void stats_histogram(FILE *f, const char *name, uint64_t *histogram,
+                                                       const char *eol) {
+    for (int i=0; i<32; i++)
+        if (histogram[i])
+            fprintf(f, "%s %llu %llu%s", name, 1ULL << i,
+                            (unsigned long long) histogram[i], eol);
+}
+
+static void stats_print(FILE *f, const char *eol) {
+    uint64_t bios = 0, bdos = 0, reads = 0, writes = 0;
+    uint64_t intercepts = bdos_calls[1] + bdos_calls[2] + bdos_calls[6]
+                        + bdos_calls[9];        // handled by bdos_entry()
+    double seconds = seconds_since(&stats_start);
+    double recent = seconds_since(&stats_last);
+
+    for (int i=0; i<17; i++)
+        bios += bios_calls[i];
+    for (int i=0; i<256; i++)
+        bdos += bdos_calls[i];
+    for (int i=0; i<32; i++) {
+        reads += disk_read_ns[i];
+        writes += disk_write_ns[i];
+    }
+
+    fprintf(f, "seconds %.6f%s", seconds, eol);
+    fprintf(f, "instructions %llu%s", (unsigned long long) icount, eol);
+    fprintf(f, "mips %.2f%s", seconds > 0 ? icount / seconds / 1e6 : 0, eol);
+    fprintf(f, "mips_recent %.2f%s", recent > 0 ?
+                        (icount - stats_last_icount) / recent / 1e6 : 0, eol);
+    fprintf(f, "bios_calls %llu%s", (unsigned long long) bios, eol);
+    fprintf(f, "bdos_calls %llu%s", (unsigned long long) bdos, eol);
+    fprintf(f, "bdos_intercepts %llu%s", (unsigned long long) intercepts, eol);
+    fprintf(f, "disk_reads %llu%s", (unsigned long long) reads, eol);
+    fprintf(f, "disk_writes %llu%s", (unsigned long long) writes, eol);
+    fprintf(f, "disk_read_bytes %llu%s", (unsigned long long) disk_read_bytes,
+                                                                        eol);
+    fprintf(f, "disk_write_bytes %llu%s",
+                                (unsigned long long) disk_write_bytes, eol);
+    fprintf(f, "console_in_bytes %llu%s",
+                                (unsigned long long) console_in_bytes, eol);
+    fprintf(f, "console_out_bytes %llu%s",
+                                (unsigned long long) console_out_bytes, eol);
+    fprintf(f, "input_wait_seconds %.6f%s", input_wait, eol);
+    for (int i=0; i<17; i++)
+        if (bios_calls[i])
+            fprintf(f, "bios %d %llu%s", i,
+                                (unsigned long long) bios_calls[i], eol);
+    for (int i=0; i<256; i++)
+        if (bdos_calls[i])
+            fprintf(f, "bdos %d %llu%s", i,
+                                (unsigned long long) bdos_calls[i], eol);
+    stats_histogram(f, "disk_read_ns", disk_read_ns, eol);
+    stats_histogram(f, "disk_write_ns", disk_write_ns, eol);
+
+    clock_gettime(CLOCK_MONOTONIC, &stats_last);
+    stats_last_icount = icount;
+}
+
+// Through a temporary file, so a reader never sees half of it
+
+static void stats_dump(void) {
+    char *name = getenv("ATARI8080_STATS");
+    char tmp[4096];
+
+    if (!name) return;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+    stats_print(f, "\n");
+    fclose(f);
+    rename(tmp, name);
+}
+
+static void stats_requests(void) {
+    if (stats_print_request) {
+        stats_print_request = 0;
+        stats_print(stderr, isatty(2) ? "\r\n" : "\n");
+    }
+    if (stats_write_request) {
+        stats_write_request = 0;
+        stats_dump();
+    }
+}
+
+static void stats_signal(int sig) {
+    if (sig == SIGUSR1)
+        stats_print_request = 1;
+    else
+        stats_write_request = 1;
+    run_request = 1;
+}
+
+// Without SA_RESTART, so a read from the keyboard returns
+
+static void stats_init(void) {
+    struct sigaction sa = { .sa_handler = stats_signal };
+    char *interval = getenv("ATARI8080_STATS_INTERVAL");
+
+    clock_gettime(CLOCK_MONOTONIC, &stats_start);
+    stats_last = stats_start;
+    sigaction(SIGUSR1, &sa, NULL);
+    if (interval && atof(interval) > 0 && getenv("ATARI8080_STATS")) {
+        double t = atof(interval);
+        struct itimerval it;
+        it.it_interval.tv_sec = t;
+        it.it_interval.tv_usec = (t - (int) t) * 1e6;
+        it.it_value = it.it_interval;
+        sigaction(SIGALRM, &sa, NULL);
+        setitimer(ITIMER_REAL, &it, NULL);
+    }
+}
+
+// -------------------------------------------------------------------------
+// Lockstep validation, see lockstep8080.c. This file is compiled twice into
+// the same program, once as the reference machine and once as the
+// candidate. All of their state is static, so they share nothing. LOCKSTEP
+// is the prefix of the functions that the driver calls, ref or cand.
+
+#ifdef LOCKSTEP
+#include "lockstep.h"
+
+static int lockstep_mode;           // LOCKSTEP_INSN, _BLOCK or _TRAP
+static int lockstep_reference;      // quiet, and replays the console input
+static int lockstep_fuzzing;        // no BIOS or BDOS, see fuzz8080.c
+static int lockstep_stop, lockstep_status;
+static uint64_t lockstep_limit = UINT64_MAX;    // stop at this icount
+static uint8_t lockstep_dirty[256] __attribute__((aligned(8)));
+static struct lockstep_insn lockstep_history[LOCKSTEP_HISTORY];
+
+#define lockstep_sync(level)    if (lockstep_mode <= (level)) lockstep_stop = 1;
+#define lockstep_touch(adr)     lockstep_dirty[(uint16_t) (adr) >> 8] = 1;
+#define lockstep_touch_all()    memset(lockstep_dirty, 1, sizeof(lockstep_dirty));
+#define lockstep_trace(pc) \
+    lockstep_history[icount & (LOCKSTEP_HISTORY-1)] = \
+        (struct lockstep_insn) { icount, pc, instruction, byte2, byte3 };
+#define console_input(value) \
+    (lockstep_reference ? lockstep_replay() : lockstep_record(value))
+#define console_quiet()         lockstep_reference
+#define lockstep_error(status)  { lockstep_status = (status); return; }
+#define lockstep_io()           if (lockstep_fuzzing) lockstep_error(LOCKSTEP_IO)
+#else
+#define lockstep_error(status)
+#define lockstep_io()
+#define lockstep_sync(level)
+#define lockstep_touch(adr)
+#define lockstep_touch_all()
+#define lockstep_trace(pc)
+#endif
+
+// -------------------------------------------------------------------------
+// Reverse execution, see reverse8080.c. run_emulator() returns to it at
+// reverse_next, which is also set to 0 to stop as soon as possible. While
+// the machine runs again what it ran before, up to reverse_frontier, the
+// console input comes from the inputs recorded the first time, and nothing
+// is printed.
+
+#ifdef REVERSE
+enum {                              // why it stopped early
+    REVERSE_NONE = 0,
+    REVERSE_HLT,
+    REVERSE_UNDEFINED,              // undefined opcode
+    REVERSE_BDOS,                   // a program wrote to the BDOS area
+};
+
+static uint64_t reverse_next = UINT64_MAX;
+static uint64_t reverse_frontier;
+static int reverse_reason;
+static uint8_t reverse_dirty[256];  // pages written since the last checkpoint
+static uint16_t reverse_pc;         // of the current instruction
+static int32_t reverse_watch = -1;  // address to watch, or -1
+static uint64_t reverse_written;    // when it was last written, and by
+static uint16_t reverse_writer;
+static int reverse_bdos_break;      // stop at writes to the BDOS area
+
+static size_t reverse_cursor, reverse_ninputs;
+
+static int reverse_replay(void);
+static int reverse_record(int value);
+static void reverse_disk_write(int drive, long sector);
+
+#define reverse_touch(adr)      reverse_dirty[(uint16_t) (adr) >> 8] = 1;
+#define reverse_touch_all()     memset(reverse_dirty, 1, sizeof(reverse_dirty));
+#define reverse_instruction(pc) reverse_pc = (pc);
+#define reverse_write(adr, pc) \
+    if ((adr) == reverse_watch) { \
+        reverse_written = icount; \
+        reverse_writer = reverse_pc; \
+    } \
+    if (reverse_bdos_break && (adr) >= BDOS && (pc) < CPMB) { \
+        reverse_reason = REVERSE_BDOS; \
+        reverse_next = 0; \
+    }
+#define reverse_stop(reason)    { reverse_reason = (reason); return; }
+#define console_input(value) \
+    (reverse_cursor < reverse_ninputs ? reverse_replay() : reverse_record(value))
+#define console_quiet()         (icount < reverse_frontier)
+#else
+#define reverse_touch(adr)
+#define reverse_touch_all()
+#define reverse_instruction(pc)
+#define reverse_write(adr, pc)
+#define reverse_stop(reason)
+#define reverse_disk_write(drive, sector)
+#endif
+
+#if !defined(LOCKSTEP) && !defined(REVERSE)
+#define console_input(value)    (value)
+#define console_quiet()         0
+#endif
+
+// -------------------------------------------------------------------------
+// Instrumentation on demand. The run loop is compiled twice, see
+// run_emulator(): bare, and instrumented with breakpoints, watchpoints,
+// tracing and opcode counts. Every build switches between them at the next
+// instruction after instrument_set(), or on SIGUSR2, which toggles. The
+// instrumented loop sees every instruction: it does not run fused
+// instructions or native code.
+//
+// When it is switched on, it reads what to do from the file named by
+// ATARI8080_INSTRUMENT, one item per line:
+//
+//   trace [file]       every instruction and the registers (stderr)
+//   break adr          show the registers when PC gets to adr
+//   watch adr [adr]    show what instructions write to adr, or the range
+//
+// Without the file it only counts. The counts are printed when it is
+// switched off again.
+
+static volatile sig_atomic_t instrument_wanted;
+static int instrumented;
+
+static FILE *instrument_trace;
+static uint8_t instrument_break[65536 / 8];
+static int32_t instrument_watch_lo = -1, instrument_watch_hi = -1;
+static uint16_t instrument_pc;
+static uint64_t instrument_icount, instrument_counts[256];
+
+static void instrument_set(int on) {
+    instrument_wanted = on;
+    run_request = 1;
+}
+
+static void instrument_signal(int sig) {
+    instrument_set(!instrument_wanted);
+}
+
+static void instrument_registers(FILE *f) {
+    fprintf(f, "A=%02X F=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%02X%02X\n",
+                A, F, B, C, D, E, H, L, SPH, SPL);
+}
+
+static void instrument_begin(void) {
+    char *name = getenv("ATARI8080_INSTRUMENT");
+    char line[256], arg[200];
+    unsigned lo, hi;
+
+    instrument_icount = icount;
+    memset(instrument_counts, 0, sizeof(instrument_counts));
+    memset(instrument_break, 0, sizeof(instrument_break));
+    instrument_watch_lo = instrument_watch_hi = -1;
+    instrument_trace = NULL;
+
+    FILE *f = name ? fopen(name, "r") : NULL;
+    if (name && !f)
+        fprintf(stderr, "unable to open %s\n", name);
+    while (f && fgets(line, sizeof(line), f)) {
+        int n;
+        if (sscanf(line, "trace %199s", arg) == 1) {
+            instrument_trace = fopen(arg, "w");
+            if (!instrument_trace)
+                fprintf(stderr, "unable to create %s\n", arg);
+        } else if (!strncmp(line, "trace", 5)) {
+            instrument_trace = stderr;
+        } else if (sscanf(line, "break %x", &lo) == 1) {
+            instrument_break[(lo & 0xffff) >> 3] |= 1 << (lo & 7);
+        } else if ((n = sscanf(line, "watch %x %x", &lo, &hi)) >= 1) {
+            instrument_watch_lo = lo & 0xffff;
+            instrument_watch_hi = n == 2 ? hi & 0xffff : lo & 0xffff;
+        }
+    }
+    if (f)
+        fclose(f);
+    fprintf(stderr, "instrumented at instruction %llu\n",
+                                        (unsigned long long) icount);
+}
+
+static void instrument_end(void) {
+    fprintf(stderr, "instrumented for %llu instructions, most frequent:\n",
+                        (unsigned long long) (icount - instrument_icount));
+    for (int n=0; n<10; n++) {
+        int max = 0;
+        for (int i=1; i<256; i++)
+            if (instrument_counts[i] > instrument_counts[max])
+                max = i;
+        if (!instrument_counts[max])
+            break;
+        fprintf(stderr, "  %02X %-12s %llu\n", max, mnemonics[max],
+                            (unsigned long long) instrument_counts[max]);
+        instrument_counts[max] = 0;
+    }
+    if (instrument_trace && instrument_trace != stderr)
+        fclose(instrument_trace);
+    instrument_trace = NULL;
+}
+
+static void instrument_instruction(uint16_t pc) {
+    instrument_pc = pc;
+    instrument_counts[instruction]++;
+    if (instrument_break[pc >> 3] & (1 << (pc & 7))) {
+        fprintf(stderr, "break at %04X, instruction %llu: ", pc,
+                                            (unsigned long long) icount);
+        instrument_registers(stderr);
+    }
+    if (instrument_trace) {
+        fprintf(instrument_trace, "%llu %04X %02X %-12s ",
+                (unsigned long long) icount, pc, instruction,
+                mnemonics[instruction]);
+        instrument_registers(instrument_trace);
+    }
+}
+
+// Not inlined, so the bare loop stays as it was
+
+static __attribute__((noinline)) void instrument_write(uint8_t LOW,
+                                                uint8_t HIGH, uint8_t VAL) {
+    uint16_t adr = (HIGH<<8) | LOW;
+
+    if (adr >= instrument_watch_lo && adr <= instrument_watch_hi)
+        fprintf(stderr, "write %02X to %04X (was %02X) by %04X, "
+                        "instruction %llu\n", VAL, adr,
+                        mem[adr>>14][adr&0x3fff], instrument_pc,
+                        (unsigned long long) icount);
+    mem_write(LOW, HIGH, VAL);
+}
+
+// Console input. Normally the keyboard, or the file named by
+// ATARI8080_INPUT to run a fixed script. The script is only read when a
+// program asks for a character, and console status always says there is
+// none, so the BDOS doesn't eat typed ahead characters while it checks for
+// ^S. Line feeds are sent as carriage returns. The emulator exits at the
+// end of the script.
+
+static FILE *console_script;
+
+// Record and replay. ATARI8080_RECORD names a log of everything the
+// machine gets from outside: the characters read from the console, the
+// results of console status checks, the host time of hypercalls, and with
+// ATARI8080_RECORD_DISK set also the contents of every sector read, each
+// with the instruction count. A run of equal status results is one line.
+// ATARI8080_REPLAY runs such a log instead of the keyboard, without a
+// terminal, and exits at its end. It stops with an error when the program
+// asks for something else than the log has next, or at another
+// instruction count (not checked by atari8080-aot, native code does not
+// count its instructions).
+//
+// A replay without recorded sectors needs the disk images as they were
+// when the recording started.
+
+static FILE *record_file, *replay_file;
+static int record_disk, replay_disk;
+static int record_kind, record_value;          // pending run of statuses
+static uint64_t record_icount, record_repeat;
+
+static void record_flush(void) {
+    if (record_repeat) {
+        fprintf(record_file, "%llu %c %d %llu\n",
+                    (unsigned long long) record_icount, record_kind,
+                    record_value, (unsigned long long) record_repeat);
+        record_repeat = 0;
+    }
+}
+
+static void record_close(void) {
+    record_flush();
+    fclose(record_file);
+}
+
+// kind is 's' for CONST, 'r' for C_RAWIO polls and 'c' for characters,
+// see hcall_input() for the others
+
+static int record_input(int kind, int value) {
+    if (!record_file)
+        return value;
+    if (kind != 'c') {
+        if (record_repeat && kind == record_kind && value == record_value) {
+            record_repeat++;
+            return value;
+        }
+        record_flush();
+        record_kind = kind;
+        record_value = value;
+        record_icount = icount;
+        record_repeat = 1;
+        return value;
+    }
+    record_flush();
+    fprintf(record_file, "%llu c %d\n", (unsigned long long) icount, value);
+    return value;
+}
+
+// The n bytes of a sector read, fewer beyond the end of the image
+
+static void record_sector(const uint8_t *data, int n) {
+    if (!record_file || !record_disk)
+        return;
+    record_flush();
+    fprintf(record_file, "%llu d ", (unsigned long long) icount);
+    for (int i=0; i<n; i++)
+        fprintf(record_file, "%02x", data[i]);
+    fprintf(record_file, "\n");
+}
+
+static char replay_line[512];
+static int replay_kind, replay_value;
+static uint64_t replay_repeat;
+
+static void replay_error(const char *what, int kind) {
+    fprintf(stderr, "replay: %s, %c at instruction %llu: %s", what, kind,
+                                (unsigned long long) icount, replay_line);
+    exit(1);
+}
+
+// Returns the next line of the log, which must be of this kind.
+
+static char *replay_next(int kind) {
+    unsigned long long ic, repeat = 1;
+    int n;
+    char k;
+
+    if (!fgets(replay_line, sizeof(replay_line), replay_file)) {
+        fprintf(stderr, "end of replay\n");
+        exit(0);
+    }
+    if (sscanf(replay_line, "%llu %c %n", &ic, &k, &n) < 2)
+        replay_error("bad line", kind);
+    if (k != kind)
+        replay_error("the program asks for something else", kind);
+#ifndef AOT
+    if (ic != icount)
+        replay_error("at another instruction count", kind);
+#endif
+    if (kind != 'd') {
+        sscanf(replay_line + n, "%d %llu", &replay_value, &repeat);
+        replay_repeat = repeat;
+    }
+    return replay_line + n;
+}
+
+static int replay_input(int kind) {
+    if (replay_repeat && kind == replay_kind) {
+        replay_repeat--;
+        return replay_value;
+    }
+    replay_next(kind);
+    replay_kind = kind;
+    replay_repeat--;
+    return replay_value;
+}
+
+// Returns the number of bytes recorded, or -1 if the sector is read from
+// the image instead.
+
+static int replay_sector(uint8_t *data) {
+    int n;
+
+    if (!replay_file || !replay_disk)
+        return -1;
+    replay_repeat = 0;                  // a sector ends a run of statuses
+    char *hex = replay_next('d');
+    for (n=0; n<128 && isxdigit((unsigned char) hex[2*n])
+                    && isxdigit((unsigned char) hex[2*n+1]); n++) {
+        unsigned x;
+        sscanf(hex + 2*n, "%2x", &x);
+        data[n] = x;
+    }
+    return n;
+}
+
+static int console_status(void) {
+    return console_input(replay_file ? replay_input('s')
+                            : record_input('s', console_script ? 0 : kbhit()));
+}
+
+static int console_ready(void) {    // for C_RAWIO, a script is always ready
+    return console_input(replay_file ? replay_input('r')
+                            : record_input('r', console_script ? 1 : kbhit()));
+}
+
+static int console_read(void) {
+    if (!console_script) {
+        struct timespec t;
+        int c;
+
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        while ((c = getchar()) == EOF && ferror(stdin) && errno == EINTR) {
+            clearerr(stdin);        // a signal, see stats_init()
+            input_wait += seconds_since(&t);
+            clock_gettime(CLOCK_MONOTONIC, &t);
+            stats_requests();
+        }
+        input_wait += seconds_since(&t);
+#ifdef SESSIONS
+        if (c == EOF)               // the user hung up
+            exit(0);
+#endif
+        return c;
+    }
+
+    int c = fgetc(console_script);
+    if (c == EOF) {
+        fprintf(stderr, "end of input script\n");
+        exit(0);
+    }
+    return c == '\n' ? '\r' : c;
+}
+
+static int console_getchar(void) {
+    console_in_bytes++;
+    return console_input(replay_file ? replay_input('c')
+                                     : record_input('c', console_read()));
+}
+
+static void console_putchar(int c) {
+    console_out_bytes++;
+    if (!console_quiet())
+        putchar(c);
+}
+
+static uint16_t dma_address;
+static uint16_t drive_number;
+static uint16_t track_number;
+static uint16_t sector_number;
+
+// Disk images, drives A: to P:. A drive is one of
+//
+//   disk.img               an image file
+//   base.img+delta         an overlay: the base image is opened read-only
+//                          and can be shared by any number of sessions, and
+//                          the sectors they write go to their own delta,
+//                          see overlay.h. The delta is created if it does
+//                          not exist. overlay8080 merges it into the base,
+//                          or it is simply removed.
+//   manifest               an image in a content-addressed store, made by
+//                          store8080, see store.c
+//   mmap:disk.img          an image file, mapped into memory
+//   ram:kB[,...]           a RAM disk, see disk_open_ram()
+//   dir:path               the files in a host directory, see
+//                          disk_open_dir()
+//
+// A drive is opened when it is first selected. A: and B: use the disk
+// parameters in the BIOS, for the atarihd geometry, so they cannot be RAM
+// disks. The other drives get theirs from disk_parameters().
+
+#define NDRIVES 16
+
+struct disk {
+    const char *name;
+    int opened;                     // 1 if open, -1 if it failed
+    FILE *f;                        // the image, or the base of an overlay
+    dev_t dev;                      // of the image, for the sector cache
+    ino_t ino;
+    FILE *delta;
+    long base_sectors;
+    uint32_t *index;                // record+1 of every sector, 0 if none
+    uint32_t nindex, nrecords;
+    struct store_image *image;      // a manifest
+    uint8_t *ram;                   // a RAM disk, mapped image or directory
+    long ram_size;
+    int mapped;
+    char *save;                     // written there at exit
+    char *dir;                      // a host directory
+    struct dir_file *files;         // imported from it
+    int nfiles;
+    long sectors;                   // geometry
+    int spt, off, block, dirents;
+    uint16_t dph;                   // in the BIOS
+    uint8_t *alv;                   // saved allocation vector
+    int alv_size;
+};
+
+static struct disk dsk[NDRIVES];
+
+static int disk_open_overlay(struct disk *d, const char *base,
+                                             const char *delta) {
+    struct overlay_header h;
+    struct overlay_record r;
+
+    d->f = fopen(base, "rb");
+    if (!d->f)
+        return -1;
+    fseek(d->f, 0, SEEK_END);
+    d->base_sectors = (ftell(d->f) + 127) / 128;
+    d->sectors = d->base_sectors;
+
+    d->delta = fopen(delta, "rb+");
+    if (!d->delta) {
+        d->delta = fopen(delta, "wb+");
+        if (!d->delta)
+            return -1;
+        memset(&h, 0, sizeof(h));
+        strcpy(h.magic, OVERLAY_MAGIC);
+        h.base_size = ftell(d->f);
+        if (fwrite(&h, sizeof(h), 1, d->delta) != 1)
+            return -1;
+    } else if (fread(&h, sizeof(h), 1, d->delta) != 1
+            || strcmp(h.magic, OVERLAY_MAGIC)) {
+        fprintf(stderr, "%s is not a delta\n", delta);
+        return -1;
+    } else if (h.base_size != ftell(d->f)) {
+        fprintf(stderr, "%s belongs to another base image\n", delta);
+        return -1;
+    }
+
+    d->nindex = d->base_sectors;
+    d->index = calloc(d->nindex + 1, sizeof(*d->index));
+    d->nrecords = 0;
+    while (fread(&r, sizeof(r), 1, d->delta) == 1) {
+        if (r.sector >= d->nindex) {
+            d->index = realloc(d->index, (r.sector + 1) * sizeof(*d->index));
+            memset(d->index + d->nindex, 0,
+                            (r.sector + 1 - d->nindex) * sizeof(*d->index));
+            d->nindex = r.sector + 1;
+        }
+        d->index[r.sector] = ++d->nrecords;
+    }
+    return 0;
+}
+
+// ram:SIZE[,block=N][,dirents=N][,save=FILE], SIZE in kB. Starts empty,
+// or with the contents of the save file if there is one, which are written
+// back at exit.
+
+static int disk_open_ram(struct disk *d, const char *spec) {
+    char save[4096] = "";
+    const char *p = strchr(spec, ',');
+    long size = atol(spec + 4);
+
+    d->block = d->dirents = 0;
+    while (p) {
+        if (!strncmp(p, ",save=", 6))
+            snprintf(save, sizeof(save), "%.*s", (int) strcspn(p+6, ","), p+6);
+        else if (!strncmp(p, ",block=", 7))
+            d->block = atoi(p+7);
+        else if (!strncmp(p, ",dirents=", 9))
+            d->dirents = atoi(p+9);
+        p = strchr(p+1, ',');
+    }
+    if (size < 16 || size > 8192) {
+        fprintf(stderr, "a RAM disk has 16 to 8192 kB\n");
+        return -1;
+    }
+    if (d->block && (d->block < 1024 || d->block > 16384
+                                     || (d->block & (d->block - 1)))) {
+        fprintf(stderr, "a RAM disk has blocks of 1, 2, 4, 8 or 16 kB\n");
+        return -1;
+    }
+    d->ram_size = (size + 3) / 4 * 4 * 1024;    // whole tracks
+    d->ram = malloc(d->ram_size);
+    if (!d->ram)
+        return -1;
+    memset(d->ram, 0xe5, d->ram_size);          // empty directory
+    d->sectors = d->ram_size / 128;
+    d->spt = 32;
+    d->off = 0;
+    if (!d->block)                  // at most 512 blocks, 256 of 1 kB
+        for (d->block = 1024; d->ram_size / d->block >
+                              (d->block == 1024 ? 256 : 512); )
+            d->block *= 2;
+    if (*save) {
+        FILE *f = fopen(save, "rb");
+        if (f) {
+            size_t n = fread(d->ram, 1, d->ram_size, f);
+            int more = fgetc(f) != EOF;
+            fclose(f);
+            if (n != (size_t) d->ram_size || more) {
+                fprintf(stderr, "%s does not have the %ld kB of the RAM "
+                                "disk\n", save, d->ram_size / 1024);
+                free(d->ram);
+                d->ram = NULL;
+                return -1;
+            }
+        }
+        d->save = strdup(save);
+    }
+    return 0;
+}
+
+// mmap:disk.img. The image is written by the kernel, and can be seen by
+// every process that maps it.
+
+static int disk_open_mmap(struct disk *d, const char *name) {
+    struct stat st;
+    int fd = open(name, O_RDWR);
+
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < 128)
+        return -1;
+    d->ram_size = st.st_size / 128 * 128;
+    d->ram = mmap(NULL, d->ram_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                                                fd, 0);
+    close(fd);
+    if (d->ram == MAP_FAILED) {
+        d->ram = NULL;
+        return -1;
+    }
+    d->mapped = 1;
+    d->sectors = d->ram_size / 128;
+    return 0;
+}
+
+// dir:path. The files of the host directory are copied to an empty image
+// in memory, as user 0, and the files of user 0 are written back at exit:
+// those that are new or changed, and imported files that were erased are
+// removed. Names that are not 8.3 and files that do not fit are left out.
+// Files are whole records, the last one is padded with ^Z.
+
+#define DIR_SECTORS     (455 * 18)      // atarihd
+#define DIR_BLOCK       2048
+#define DIR_ENTRIES     128
+
+struct dir_file {
+    char name[11];                  // as in the directory
+    char *host;
+};
+
+static int dir_name(char *name, const char *host) {
+    const char *dot = strrchr(host, '.');
+    int len = dot ? dot - host : strlen(host);
+    int extlen = dot ? strlen(dot+1) : 0;
+
+    if (!len || len > 8 || extlen > 3)
+        return -1;
+    memset(name, ' ', 11);
+    for (int i=0; host[i]; i++) {
+        int c = (unsigned char) host[i];
+        if (i == len)
+            continue;
+        if (c <= ' ' || c >= 0x7f || strchr("<>.,;:=?*[]|/\\", c))
+            return -1;
+        name[i < len ? i : 8 + i - len - 1] = toupper(c);
+    }
+    return 0;
+}
+
+static uint8_t *dir_entry(struct disk *d, int i) {
+    return d->ram + d->off * d->spt * 128 + i * 32;
+}
+
+static uint8_t *dir_record(struct disk *d, int block, int record) {
+    return d->ram + d->off * d->spt * 128 + block * DIR_BLOCK + record * 128;
+}
+
+static uint8_t *dir_read_file(const char *path, long *size) {
+    FILE *f = fopen(path, "rb");
+    uint8_t *data;
+
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    data = malloc((*size + 127) / 128 * 128 + 1);
+    if (data && fread(data, 1, *size, f) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    if (data)
+        memset(data + *size, 0x1a, -*size & 127);
+    return data;
+}
+
+static int disk_open_dir(struct disk *d, const char *path) {
+    int entries = 0, block = DIR_ENTRIES * 32 / DIR_BLOCK;
+    int blocks = (DIR_SECTORS - 18) * 128 / DIR_BLOCK;
+    char host[4096];
+    struct dirent *e;
+    struct stat st;
+    long size;
+
+    DIR *dir = opendir(path);
+    if (!dir)
+        return -1;
+    d->dir = strdup(path);
+    d->ram_size = DIR_SECTORS * 128L;
+    d->ram = malloc(d->ram_size);
+    if (!d->ram || !d->dir)
+        return -1;
+    memset(d->ram, 0xe5, d->ram_size);
+    d->sectors = DIR_SECTORS;
+
+    while ((e = readdir(dir))) {
+        struct dir_file file;
+        int i;
+
+        snprintf(host, sizeof(host), "%s/%s", path, e->d_name);
+        if (dir_name(file.name, e->d_name) < 0 || stat(host, &st) < 0
+                                               || !S_ISREG(st.st_mode))
+            continue;
+        for (i=0; i<d->nfiles; i++)
+            if (!memcmp(d->files[i].name, file.name, 11))
+                break;
+        uint8_t *data = i == d->nfiles ? dir_read_file(host, &size) : NULL;
+        if (!data)
+            continue;
+
+        long records = (size + 127) / 128;
+        int extents = records ? (records + 127) / 128 : 1;
+        if (entries + extents > DIR_ENTRIES
+                || block + (records + 15) / 16 > blocks) {
+            fprintf(stderr, "%s does not fit on the disk\n", host);
+            free(data);
+            continue;
+        }
+        for (int x=0; x<extents; x++) {
+            uint8_t *entry = dir_entry(d, entries++);
+            long rc = records - x * 128L;
+            memset(entry, 0, 32);
+            memcpy(entry + 1, file.name, 11);
+            entry[12] = x & 0x1f;
+            entry[14] = x >> 5;
+            entry[15] = rc > 128 ? 128 : rc;
+            for (int r=0; r<entry[15]; r++) {
+                if (r % 16 == 0) {
+                    entry[16 + r/16*2] = block;
+                    entry[17 + r/16*2] = block >> 8;
+                    block++;
+                }
+                memcpy(dir_record(d, block - 1, r % 16),
+                       data + (x * 128L + r) * 128, 128);
+            }
+        }
+        free(data);
+        file.host = strdup(e->d_name);
+        d->files = realloc(d->files, (d->nfiles + 1) * sizeof(*d->files));
+        d->files[d->nfiles++] = file;
+    }
+    closedir(dir);
+    return 0;
+}
+
+static void disk_save_dir(struct disk *d) {
+    static uint8_t data[DIR_SECTORS * 128];
+    int blocks = (DIR_SECTORS - 18) * 128 / DIR_BLOCK;
+    char host[4096], name[11], lower[13];
+
+    for (int i=0; i<DIR_ENTRIES; i++) {
+        uint8_t *entry = dir_entry(d, i);
+        long records = 0;
+        int j, n = 0;
+
+        if (entry[0] != 0)              // other users, or erased
+            continue;
+        for (j=0; j<11; j++)
+            name[j] = entry[1+j] & 0x7f;    // without the attributes
+        for (j=0; j<i; j++)
+            if (!dir_entry(d, j)[0] && !memcmp(dir_entry(d, j) + 1,
+                                               entry + 1, 11))
+                break;
+        if (j < i)                      // already written
+            continue;
+
+        for (j=i; j<DIR_ENTRIES; j++) {
+            uint8_t *x = dir_entry(d, j);
+            if (x[0] || memcmp(x + 1, entry + 1, 11))
+                continue;
+            long first = ((x[12] & 0x1f) + 32 * x[14]) * 128L;
+            int rc = x[15] > 128 ? 128 : x[15];
+            for (int r=0; r<rc; r++) {
+                int block = x[16 + r/16*2] | x[17 + r/16*2] << 8;
+                if (block >= blocks || first + r >= DIR_SECTORS)
+                    break;
+                memcpy(data + (first + r) * 128, dir_record(d, block, r % 16),
+                                                                128);
+                if (first + r + 1 > records)
+                    records = first + r + 1;
+            }
+        }
+
+        for (j=0; j<d->nfiles; j++)
+            if (!memcmp(d->files[j].name, name, 11))
+                break;
+        if (j < d->nfiles) {
+            snprintf(host, sizeof(host), "%s/%s", d->dir, d->files[j].host);
+            d->files[j].name[0] = 0;    // still there
+        } else {
+            for (j=0; j<11; j++) {
+                if (j == 8 && name[j] != ' ')
+                    lower[n++] = '.';
+                if (name[j] != ' ')
+                    lower[n++] = tolower(name[j]);
+            }
+            lower[n] = 0;
+            snprintf(host, sizeof(host), "%s/%s", d->dir, lower);
+        }
+
+        long size;
+        uint8_t *old = dir_read_file(host, &size);
+        int same = old && (size + 127) / 128 == records
+                       && !memcmp(old, data, records * 128);
+        free(old);
+        if (same)
+            continue;
+        FILE *f = fopen(host, "wb");
+        if (!f || fwrite(data, 128, records, f) != records)
+            fprintf(stderr, "unable to write %s\n", host);
+        if (f)
+            fclose(f);
+    }
+
+    for (int j=0; j<d->nfiles; j++)
+        if (d->files[j].name[0]) {      // erased
+            snprintf(host, sizeof(host), "%s/%s", d->dir, d->files[j].host);
+            remove(host);
+        }
+}
+
+static void disk_save(void) {
+    for (int i=0; i<NDRIVES; i++) {
+        if (dsk[i].dir)
+            disk_save_dir(&dsk[i]);
+        if (!dsk[i].save)
+            continue;
+        FILE *f = fopen(dsk[i].save, "wb");
+        if (!f || fwrite(dsk[i].ram, 1, dsk[i].ram_size, f) != dsk[i].ram_size)
+            fprintf(stderr, "unable to write %s\n", dsk[i].save);
+        if (f)
+            fclose(f);
+    }
+}
+
+static int disk_open(struct disk *d, const char *name) {
+    char base[4096];
+    const char *plus = strchr(name, '+');
+
+    d->sectors = 0;
+    d->spt = 18;                    // atarihd, see cpm22/bios.asm
+    d->off = 1;
+    d->block = 2048;
+    d->dirents = 128;
+    if (!strncmp(name, "ram:", 4))
+        return disk_open_ram(d, name);
+    if (!strncmp(name, "mmap:", 5))
+        return disk_open_mmap(d, name + 5);
+    if (!strncmp(name, "dir:", 4))
+        return disk_open_dir(d, name + 4);
+    if (!plus) {
+        struct store_image m;
+        int r = store_image_open(&m, name);
+        if (r) {
+            d->image = malloc(sizeof(m));
+            if (r < 0 || !d->image)
+                return -1;
+            *d->image = m;
+            d->sectors = m.sectors;
+            return 0;
+        }
+        d->f = fopen(name, "rb+");
+        if (!d->f)
+            return -1;
+#ifdef SESSIONS
+        setvbuf(d->f, NULL, _IONBF, 0);     // the other sessions write it
+#endif
+        struct stat st;
+        if (fstat(fileno(d->f), &st) == 0) {
+            d->dev = st.st_dev;
+            d->ino = st.st_ino;
+        }
+        fseek(d->f, 0, SEEK_END);
+        d->sectors = ftell(d->f) / 128;
+        return 0;
+    }
+    snprintf(base, sizeof(base), "%.*s", (int) (plus - name), name);
+    return disk_open_overlay(d, base, plus + 1);
+}
+
+static void disk_close(void) {
+    for (int i=0; i<NDRIVES; i++) {
+        if (dsk[i].f)
+            fclose(dsk[i].f);
+        if (dsk[i].delta)
+            fclose(dsk[i].delta);
+        if (dsk[i].image)
+            close(dsk[i].image->fd);
+        if (dsk[i].mapped)
+            msync(dsk[i].ram, dsk[i].ram_size, MS_SYNC);
+    }
+}
+
+static long overlay_offset(uint32_t record) {
+    return sizeof(struct overlay_header)
+         + (record - 1) * (long) sizeof(struct overlay_record);
+}
+
+// Returns the number of bytes read, less than 128 at the end of the image,
+// or -1.
+
+static int disk_read(int drive, long sector, uint8_t *data) {
+    struct disk *d = &dsk[drive];
+
+    if (d->ram) {
+        if (sector >= d->ram_size / 128)
+            return -1;
+        memcpy(data, d->ram + sector*128, 128);
+        return 128;
+    }
+    if (d->image)
+        return store_image_read(d->image, sector, data);
+    if (d->delta && sector < d->nindex && d->index[sector]) {
+        fseek(d->delta, overlay_offset(d->index[sector]) + 4, SEEK_SET);
+        return fread(data, 1, 128, d->delta);
+    }
+    if (fseek(d->f, sector*128, SEEK_SET) == EINVAL)
+        return -1;
+    return fread(data, 1, 128, d->f);
+}
+
+static int disk_write(int drive, long sector, const uint8_t *data) {
+    struct disk *d = &dsk[drive];
+
+    if (d->ram) {
+        if (sector >= d->ram_size / 128)
+            return -1;
+        memcpy(d->ram + sector*128, data, 128);
+        return 0;
+    }
+    if (d->image)
+        return store_image_write(d->image, sector, data);
+    if (!d->delta) {
+        if (fseek(d->f, sector*128, SEEK_SET) == EINVAL)
+            return -1;
+        return fwrite(data, 1, 128, d->f) == 128 ? 0 : -1;
+    }
+
+    if (sector >= d->nindex) {
+        uint32_t *index = realloc(d->index, (sector + 1) * sizeof(*index));
+        if (!index)
+            return -1;
+        memset(index + d->nindex, 0, (sector + 1 - d->nindex) * sizeof(*index));
+        d->index = index;
+        d->nindex = sector + 1;
+    }
+    if (d->index[sector]) {
+        fseek(d->delta, overlay_offset(d->index[sector]) + 4, SEEK_SET);
+        return fwrite(data, 1, 128, d->delta) == 128 ? 0 : -1;
+    }
+
+    struct overlay_record r = { .sector = sector };
+    memcpy(r.data, data, 128);
+    fseek(d->delta, overlay_offset(d->nrecords + 1), SEEK_SET);
+    if (fwrite(&r, sizeof(r), 1, d->delta) != 1)
+        return -1;
+    d->index[sector] = ++d->nrecords;
+    return 0;
+}
 
-// 8080 registers on page zero.
-//
-// Atari: keep PC always adjusted. BC, DE, HL and SP only when needed. The
-// latter is not used in this C implementation, but on the Atari we could
-// implement four different functions for dereferencing BC, DE, HL or SP,
-// avoiding the need to copy the low byte.
+// -------------------------------------------------------------------------
+// The sector cache of atari8080-sessions, see sessions8080.c. Every session
+// is a process of its own, forked from the server, and the cache is in
+// memory the server maps shared before it forks them. It holds sectors of
+// plain image files, the drives that the sessions share, and is written
+// through under one lock: a write goes to the image and the cache before
+// the next read or write of any session, so they all see the writes in
+// the same order. The images are unbuffered. Other drives are not cached.
+
+#ifdef SESSIONS
+#include <pthread.h>
+
+struct cache_slot {
+    dev_t dev;                      // the image
+    ino_t ino;                      // 0 if empty
+    uint32_t sector;
+    uint8_t data[128];
+};
+
+struct sector_cache {
+    pthread_mutex_t lock;           // shared by the processes
+    uint64_t hits, misses, writes;
+    uint32_t nslots;                // a power of two
+    struct cache_slot slot[];
+};
+
+static struct sector_cache *sector_cache;
+
+static struct sector_cache *cache_create(uint32_t nslots) {
+    pthread_mutexattr_t attr;
+    size_t size = sizeof(struct sector_cache)
+                + nslots * sizeof(struct cache_slot);
+    struct sector_cache *c = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (c == MAP_FAILED)
+        return NULL;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&c->lock, &attr);
+    c->nslots = nslots;
+    return c;
+}
 
-struct __attribute__((packed, aligned(1))) zp {
-    uint8_t A;
+static void cache_lock(void) {
+    if (pthread_mutex_lock(&sector_cache->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&sector_cache->lock);  // it was whole
+}
 
-    uint8_t B;
-    uint8_t C;
-    uint8_t B_adjusted;     // atari: (BC) ---> lda (C),y after adjust
+// The drives of two sessions can be different images, so sectors are
+// known by the image they are on.
 
-    uint8_t D;
-    uint8_t E;
-    uint8_t D_adjusted;
+static struct cache_slot *cache_slot(struct disk *d, long sector) {
+    uint32_t h = sector + d->ino * 0x9e3779b1u;     // runs of sectors spread
+    return &sector_cache->slot[h & (sector_cache->nslots - 1)];
+}
 
-    uint8_t H;
-    uint8_t L;
-    uint8_t H_adjusted;
+static int cache_hit(struct cache_slot *s, struct disk *d, long sector) {
+    return s->ino == d->ino && s->dev == d->dev && s->sector == sector;
+}
 
-    uint8_t SPH;
-    uint8_t SPL;
-    uint8_t SPH_adjusted;
+static void cache_fill(struct cache_slot *s, struct disk *d, long sector,
+                                                   const uint8_t *data) {
+    s->dev = d->dev;
+    s->ino = d->ino;
+    s->sector = sector;
+    memcpy(s->data, data, 128);
+}
 
-    uint8_t PCH;
-    uint8_t PCL;
-    uint8_t PCH_adjusted;
-} zp;
+static int cache_read(int drive, long sector, uint8_t *data) {
+    struct disk *d = &dsk[drive];
+    int n;
+
+    if (!sector_cache || !d->ino || d->delta)
+        return disk_read(drive, sector, data);
+    struct cache_slot *s = cache_slot(d, sector);
+    cache_lock();
+    if (cache_hit(s, d, sector)) {
+        memcpy(data, s->data, 128);
+        sector_cache->hits++;
+        n = 128;
+    } else {
+        n = disk_read(drive, sector, data);
+        sector_cache->misses++;
+        if (n == 128)
+            cache_fill(s, d, sector, data);
+    }
+    pthread_mutex_unlock(&sector_cache->lock);
+    return n;
+}
 
-#define A       zp.A
+static int cache_write(int drive, long sector, const uint8_t *data) {
+    struct disk *d = &dsk[drive];
+    int r;
 
-#define B       zp.B
-#define C       zp.C
-#define Ba      zp.B_adjusted
+    if (!sector_cache || !d->ino || d->delta)
+        return disk_write(drive, sector, data);
+    struct cache_slot *s = cache_slot(d, sector);
+    cache_lock();
+    r = disk_write(drive, sector, data);
+    sector_cache->writes++;
+    if (r == 0)
+        cache_fill(s, d, sector, data);
+    else if (cache_hit(s, d, sector))
+        s->ino = 0;
+    pthread_mutex_unlock(&sector_cache->lock);
+    return r;
+}
+#else
+#define cache_read  disk_read
+#define cache_write disk_write
+#endif
 
-#define D       zp.D
-#define E       zp.E
-#define Da      zp.D_adjusted
+// The BIOS has the disk parameters of A: and B:. Those of the other
+// drives are put behind them, a header (DPH) and parameter block (DPB)
+// each, when they are opened. They are fixed disks, without checksum
+// vector. There is no room for fourteen allocation vectors, so they share
+// the one at ALV_SHARED, which is swapped when another drive is selected:
+// the BDOS only uses that of the selected drive. Returns the address after
+// the tables, or -1 if they do not fit.
 
-#define H       zp.H
-#define L       zp.L
-#define Ha      zp.H_adjusted
+#define ALV_SHARED  0xfe00          // to the top, for 4096 blocks
 
-#define SPH     zp.SPH
-#define SPL     zp.SPL
-#define SPHa    zp.SPH_adjusted
+static uint16_t disk_tables;        // the next free address
+static int alv_owner = -1;          // the drive that has ALV_SHARED
 
-#define PCH     zp.PCH
-#define PCL     zp.PCL
-#define PCHa    zp.PCH_adjusted
+static uint16_t bios_word(uint16_t adr) {
+    return mem[3][adr & 0x3fff] | mem[3][(adr+1) & 0x3fff] << 8;
+}
 
-// PSW bits separate
-//
-// |S|Z|0|A|0|P|1|C|
+static void bios_set_word(uint16_t adr, uint16_t w) {
+    mem[3][adr & 0x3fff] = w;
+    mem[3][(adr+1) & 0x3fff] = w >> 8;
+}
 
-#define SF_FLAG     0b10000000
-#define ZF_FLAG     0b01000000
-#define AF_FLAG     0b00010000
-#define PF_FLAG     0b00000100
-#define ONE_FLAG    0b00000010      // always set!
-#define CF_FLAG     0b00000001
+static long disk_parameters(uint16_t adr, struct disk *d) {
+    int block = d->block, dirents = d->dirents;
+    long blocks = (d->sectors - (long) d->off * d->spt) * 128 / block;
+    int bsh = 0;
+
+    while ((128 << bsh) < block)
+        bsh++;
+    if (!dirents)
+        dirents = block > 2048 ? block / 32 : 64;
+    int dirblocks = dirents * 32 / block;
+    if (bsh < 3 || bsh > 7 || block != 128 << bsh
+                || blocks > 4096 || blocks <= dirblocks
+                || (blocks > 256 && bsh == 3)
+                || !dirblocks || dirblocks > 16 || dirents * 32 % block) {
+        fprintf(stderr, "no such disk: %ld blocks of %d bytes, %d entries\n",
+                                            blocks, block, dirents);
+        return -1;
+    }
+    if (adr + 16 + 15 > ALV_SHARED)
+        return -1;
+
+    uint16_t dpb = adr + 16;
+    uint16_t al = 0xffff << (16 - dirblocks);
+
+    memset(&mem[3][adr & 0x3fff], 0, 16 + 15);
+    bios_set_word(adr + 8, bios_word(DPBASE + 8));  // the same DIRBUF
+    bios_set_word(adr + 10, dpb);
+    bios_set_word(adr + 14, ALV_SHARED);
+
+    bios_set_word(dpb, d->spt);
+    mem[3][(dpb + 2) & 0x3fff] = bsh;
+    mem[3][(dpb + 3) & 0x3fff] = (1 << bsh) - 1;
+    mem[3][(dpb + 4) & 0x3fff] = (block >> (blocks > 256 ? 11 : 10)) - 1;
+    bios_set_word(dpb + 5, blocks - 1);
+    bios_set_word(dpb + 7, dirents - 1);
+    mem[3][(dpb + 9) & 0x3fff] = al >> 8;
+    mem[3][(dpb + 10) & 0x3fff] = al;
+    bios_set_word(dpb + 13, d->off);
+    d->dph = adr;
+    d->alv_size = (blocks + 7) / 8;
+    d->alv = calloc(1, d->alv_size);
+    return d->alv ? dpb + 15 : -1;
+}
 
-static uint8_t F = ONE_FLAG;
+// The end of the tables of A: and B:
 
-#define ALL_FLAGS   (SF_FLAG | ZF_FLAG | AF_FLAG | PF_FLAG | ONE_FLAG | CF_FLAG)
+static uint16_t bios_tables_end(void) {
+    uint16_t end = 0;
 
-// Used during instruction fetch
+    for (int i=0; i<2; i++) {
+        uint16_t dph = DPBASE + 16*i;
+        uint16_t dpb = bios_word(dph + 10);
+        uint16_t csv = bios_word(dph + 12) + bios_word(dpb + 11);
+        uint16_t alv = bios_word(dph + 14) + bios_word(dpb + 5) / 8 + 1;
+        if (csv > end) end = csv;
+        if (alv > end) end = alv;
+    }
+    return end;
+}
 
-static uint8_t instruction, byte2, byte3;
+// Opens a drive the first time it is selected, and gives it the shared
+// allocation vector. Returns its DPH, or 0 if there is no such drive.
 
-// used during memory access
+static uint16_t disk_select(int drive) {
+    struct disk *d = &dsk[drive];
+    long end;
 
-#define byte1 instruction
+    if (!d->name || d->opened < 0)
+        return 0;
+    if (!d->opened) {
+        d->opened = -1;
+        if (disk_open(d, d->name) < 0) {
+            fprintf(stderr, "unable to open %s\n", d->name);
+            return 0;
+        }
+        if (drive < 2)
+            d->dph = DPBASE + 16*drive;
+        else if ((end = disk_parameters(disk_tables, d)) < 0) {
+            fprintf(stderr, "no room for the disk parameters of %s\n",
+                                                                d->name);
+            return 0;
+        } else
+            disk_tables = end;
+        d->opened = 1;
+    }
+    if (d->alv && alv_owner != drive) {
+        if (alv_owner >= 0)
+            memcpy(dsk[alv_owner].alv, &mem[3][ALV_SHARED & 0x3fff],
+                                       dsk[alv_owner].alv_size);
+        memcpy(&mem[3][ALV_SHARED & 0x3fff], d->alv, d->alv_size);
+        alv_owner = drive;
+    }
+    return d->dph;
+}
 
-// Assemble CCP.SYS and BDOS.SYS from https://github.com/brouhaha/cpm22
-// Assembler: http://john.ccac.rwth-aachen.de:8000/as/
+// -------------------------------------------------------------------------
+// BIOS and BDOS call trace, to the file named by ATARI8080_CALLTRACE. One
+// JSON object per line and per call, written when the call returns:
 //
-// Standard CP/M Memory layout:
+//   {"ns":..,"icount":..,"bios":13,"name":"read","in":{..},"out":{..},
+//    "drive":0,"track":2,"sector":5,"dma":128,"took_ns":..,"in_bdos":20}
+//   {"ns":..,"icount":..,"bdos":15,"name":"F_OPEN","caller":..,"de":92,
+//    "fcb":"A:PIP.COM","in":{..},"out":{..},"insns":..,"took_ns":..}
 //
-// $E400 = CCP      (important: disable serialization!)
-// $EC00 = BDOS     (entry at $EC06)
-// $FA00 = BIOS
+// ns is the host time since the start and icount the instruction count,
+// both at the call. Registers are numbers. BIOS calls made by the BDOS come
+// before the BDOS call, with in_bdos. BDOS calls answered by the host have
+// "host":true, calls that never return (function 0, ^C, disk errors) have
+// "returned":false and no out.
 //
-// Trap BIOS calls with an unused 8080 instruction and use C functions
-// to mimic its functions.
+// The BDOS returns to the program at retmon. With the trace on, its MOV
+// A,L ; MOV B,H are replaced by another IN trap, see bdos_entry().
+
+#define TRACE_RETURN    0xff        // port of the IN at retmon
+
+struct trace_regs { uint8_t a, f; uint16_t bc, de, hl, sp; };
+
+static FILE *trace_calls;
+static struct timespec trace_start;
+
+static struct {
+    int function;
+    uint64_t icount;
+    struct timespec t;
+    struct trace_regs in;
+} trace_bios;
+
+static struct {
+    int pending, function;
+    uint64_t icount;
+    struct timespec t;
+    struct trace_regs in;
+    uint16_t caller;
+} trace_bdos;
+
+static const char *bios_names[17] = {
+    "boot", "wboot", "const", "conin", "conout", "list", "punch", "reader",
+    "home", "seldsk", "settrk", "setsec", "setdma", "read", "write",
+    "listst", "sectran"
+};
+
+static const char *bdos_names[41] = {
+    "P_TERMCPM", "C_READ", "C_WRITE", "A_READ", "A_WRITE", "L_WRITE",
+    "C_RAWIO", "A_GETIOBYTE", "A_SETIOBYTE", "C_WRITESTR", "C_READSTR",
+    "C_STAT", "S_BDOSVER", "DRV_ALLRESET", "DRV_SET", "F_OPEN", "F_CLOSE",
+    "F_SFIRST", "F_SNEXT", "F_DELETE", "F_READ", "F_WRITE", "F_MAKE",
+    "F_RENAME", "DRV_LOGINVEC", "DRV_GET", "F_DMAOFF", "DRV_ALLOCVEC",
+    "DRV_SETRO", "DRV_ROVEC", "F_ATTRIB", "DRV_DPB", "F_USERNUM",
+    "F_READRAND", "F_WRITERAND", "F_SIZE", "F_RANDREC", "DRV_RESET",
+    NULL, NULL, "F_WRITEZF"
+};
+
+static void trace_init(const char *name) {
+    trace_calls = fopen(name, "w");
+    if (!trace_calls) {
+        fprintf(stderr, "unable to create %s\n", name);
+        return;
+    }
+    setvbuf(trace_calls, NULL, _IOFBF, 1<<16);
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+}
 
-#define BIOS    0xfa00
+// Called at boot, after the BDOS is loaded
+
+static void trace_patch(void) {
+    static const uint8_t retmon[] = { 0x2a, 0, 0, 0xf9, 0x2a, 0, 0, 0x7d,
+                                      0x44, 0xc9 };     // LHLD SPHL LHLD ..
+    if (!trace_calls)
+        return;
+    for (int i=0; i+sizeof(retmon)<=bdos_sys_len; i++) {
+        int j;
+        for (j=0; j<sizeof(retmon); j++)
+            if (retmon[j] && bdos_sys[i+j] != retmon[j])
+                break;
+        if (j == sizeof(retmon)) {
+            mem[3][(BDOS&0x3fff)+i+7] = 0xdb;           // IN TRACE_RETURN
+            mem[3][(BDOS&0x3fff)+i+8] = TRACE_RETURN;
+            return;
+        }
+    }
+    fprintf(stderr, "calltrace: retmon not found, BDOS calls are not "
+                    "traced\n");
+}
 
-#define BDOS    0xec00
-#define BDOSJMP (BDOS+6)
-#define BDOSE   (BDOS+0x11)
+static void trace_registers(struct trace_regs *r) {
+    *r = (struct trace_regs) { A, F, (B<<8) | C, (D<<8) | E, (H<<8) | L,
+                               (SPH<<8) | SPL };
+}
 
-#define CPMB    0xe400          // base of cpm console processor
+static void trace_print_registers(const char *key, struct trace_regs *r) {
+    fprintf(trace_calls, ",\"%s\":{\"a\":%d,\"f\":%d,\"bc\":%d,\"de\":%d,"
+                         "\"hl\":%d,\"sp\":%d}", key, r->a, r->f, r->bc,
+                         r->de, r->hl, r->sp);
+}
 
-#define BOOTF   (BIOS+3*0)     // cold boot
-#define WBOOTF  (BIOS+3*1)     // warm boot
-#define CONSTF  (BIOS+3*2)     // console status, A=0 no char, A=ff char
-#define CONINF  (BIOS+3*3)     // console input, result in A
-#define CONOUTF (BIOS+3*4)     // console output, char in C
-#define LISTF   (BIOS+3*5)     // list output (ignore)
-#define PUNCHF  (BIOS+3*6)     // punch output (ignore)
-#define READERF (BIOS+3*7)     // reader input (ignore, return A=^Z)
-#define HOMEF   (BIOS+3*8)     // disk home (set track 0)
-#define SELDSKF (BIOS+3*9)     // select disk (disk in C, return HL=dpbase or 0)
-#define SETTRKF (BIOS+3*10)    // set track (track in C)
-#define SETSECF (BIOS+3*11)    // set sector (sector in BC or C)
-#define SETDMAF (BIOS+3*12)    // set dma (default=$80, input in BC)
-#define READF   (BIOS+3*13)    // read record (return error in A, A=0=OK)
-#define WRITEF  (BIOS+3*14)    // write record (return error in A, A=0=OK)
-#define LISTSTF (BIOS+3*15)    // list status (ignore) (A=0=not ready)
-#define SECTRAN (BIOS+3*16)    // sector translate (in BC, out in HL)
+static void trace_print_start(struct timespec *t, uint64_t count) {
+    int64_t ns = (t->tv_sec - trace_start.tv_sec) * 1000000000LL
+                + (t->tv_nsec - trace_start.tv_nsec);
 
-#define DPBASE  (BIOS + 17*3)  // see below
+    fprintf(trace_calls, "{\"ns\":%lld,\"icount\":%llu", (long long) ns,
+                                            (unsigned long long) count);
+}
 
-// -------------------------------------------------------------------------
+// Drive and file name of the FCB at adr, like B:FOO.ASM
 
-#include "tables/tables.h"
-#include "cpm22/bios.h"
-#include "cpm22/bdos.h"
-#include "cpm22/ccp.h"
+static void trace_print_fcb(uint16_t adr) {
+    char name[16], *p = name;
 
-// -------------------------------------------------------------------------
+    uint8_t drive = mem_read(adr & 0xff, adr >> 8);
+    if (drive && drive <= 16) {
+        *p++ = '@' + drive;
+        *p++ = ':';
+    }
+    for (int i=1; i<12; i++) {
+        uint16_t a = adr + i;
+        int c = mem_read(a & 0xff, a >> 8) & 0x7f;
+        if (i == 9)
+            *p++ = '.';
+        if (c == ' ')
+            continue;
+        *p++ = c < ' ' || c == '"' || c == '\\' || c == 127 ? '?' : c;
+    }
+    if (p[-1] == '.')
+        p--;
+    *p = 0;
+    fprintf(trace_calls, ",\"fcb\":\"%s\"", name);
+}
 
-// Tons of debug output. Might cut down on it a little.
+static void trace_bdos_print(int returned, int host) {
+    struct trace_regs out;
+    int f = trace_bdos.function;
+
+    trace_bdos.pending = 0;
+    if (console_quiet())
+        return;
+    trace_print_start(&trace_bdos.t, trace_bdos.icount);
+    fprintf(trace_calls, ",\"bdos\":%d", f);
+    if (f < 41 && bdos_names[f])
+        fprintf(trace_calls, ",\"name\":\"%s\"", bdos_names[f]);
+    fprintf(trace_calls, ",\"caller\":%d,\"de\":%d", trace_bdos.caller,
+                                                     trace_bdos.in.de);
+    if ((f >= 15 && f <= 23 && f != 18) || f == 30 || (f >= 33 && f <= 36)
+                                        || f == 40)
+        trace_print_fcb(trace_bdos.in.de);
+    trace_print_registers("in", &trace_bdos.in);
+    if (returned) {
+        trace_registers(&out);
+        trace_print_registers("out", &out);
+    } else {
+        fprintf(trace_calls, ",\"returned\":false");
+    }
+    if (host)
+        fprintf(trace_calls, ",\"host\":true");
+    fprintf(trace_calls, ",\"insns\":%llu,\"took_ns\":%llu}\n",
+            (unsigned long long) (icount - trace_bdos.icount),
+            (unsigned long long) (seconds_since(&trace_bdos.t) * 1e9));
+}
 
-#ifdef BIOSDEBUG
-#define biosprintf(...) fprintf(stderr, __VA_ARGS__)
-#else
-#define biosprintf(...)
-#endif
+static void trace_bios_begin(int function) {
+    if (!trace_calls)
+        return;
+    if (function <= 1 && trace_bdos.pending)   // the BDOS went to wboot
+        trace_bdos_print(0, 0);
+    trace_bios.function = function;
+    trace_bios.icount = icount;
+    trace_registers(&trace_bios.in);
+    clock_gettime(CLOCK_MONOTONIC, &trace_bios.t);
+}
 
-#ifdef DEBUG
+static void trace_bios_end(void) {
+    struct trace_regs out;
+    int f = trace_bios.function;
+
+    if (!trace_calls || console_quiet())
+        return;
+    trace_registers(&out);
+    trace_print_start(&trace_bios.t, trace_bios.icount);
+    fprintf(trace_calls, ",\"bios\":%d,\"name\":\"%s\"", f, bios_names[f]);
+    trace_print_registers("in", &trace_bios.in);
+    trace_print_registers("out", &out);
+    if (f == 13 || f == 14)
+        fprintf(trace_calls, ",\"drive\":%d,\"track\":%d,\"sector\":%d,"
+                             "\"dma\":%d", drive_number, track_number,
+                             sector_number, dma_address);
+    fprintf(trace_calls, ",\"took_ns\":%llu",
+                (unsigned long long) (seconds_since(&trace_bios.t) * 1e9));
+    if (trace_bdos.pending)
+        fprintf(trace_calls, ",\"in_bdos\":%d", trace_bdos.function);
+    fprintf(trace_calls, "}\n");
+}
 
-static int cpudump = 0, wbootcnt = 0;
+static void trace_bdos_begin(void) {
+    if (!trace_calls)
+        return;
+    if (trace_bdos.pending)
+        trace_bdos_print(0, 0);
+    trace_bdos.pending = 1;
+    trace_bdos.function = C;
+    trace_bdos.icount = icount;
+    uint16_t sp = (SPH<<8) | SPL, sp1 = sp + 1;
+    trace_bdos.caller = mem_read(sp & 0xff, sp >> 8)
+                      | mem_read(sp1 & 0xff, sp1 >> 8) << 8;
+    trace_registers(&trace_bdos.in);
+    clock_gettime(CLOCK_MONOTONIC, &trace_bdos.t);
+}
 
-static void debug_print_cpu_state(void) {
-    if (cpudump) {
-    fprintf(stderr, "PC:%02X%02X A:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X "
-           "SP:%02X%02X ", PCH, PCL, A, B, C, D, E, H, L, SPH, SPL);
-    fprintf(stderr, "S:%d Z:%d A:%d P:%d C:%d // F:%02x\n", !!F&SF_FLAG, !!F&ZF_FLAG, !!F&AF_FLAG, !!F&PF_FLAG, !!F&CF_FLAG, F);
+static void trace_bdos_end(int host) {
+    if (trace_calls && trace_bdos.pending)
+        trace_bdos_print(1, host);
+}
+
+// Loads CCP, BDOS and BIOS, and writes only the 256-byte pages that are
+// different. A page that is the same is not written, so that a session of
+// atari8080-sessions keeps sharing the pages of the server that forked it,
+// which has them loaded already, see system_load().
+
+static void mem_load(uint16_t adr, const uint8_t *data, int len) {
+    while (len > 0) {
+        int n = 256 - (adr & 0xff);
+        if (n > len)
+            n = len;
+        uint8_t *p = &mem[adr>>14][adr&0x3fff];
+        if (memcmp(p, data, n))
+            memcpy(p, data, n);
+        adr += n;
+        data += n;
+        len -= n;
     }
 }
 
-static void debug_print_instruction(void) {
-    if (cpudump) {
-    fprintf(stderr, ">>> %s ", mnemonics[instruction]);
-    int mode = modes[instruction];
-    switch (mode) {
-    case MODE_D8:   fprintf(stderr, "%02XH", byte2);   break;
-    case MODE_D16:
-    case MODE_ADR:
-    case MODE_JMP:  fprintf(stderr, "%02X%02XH", byte3, byte2); break;
-    default:        break;
+// The BDOS as the cold boot loads it, with the trap. BDOS is at the start
+// of a page.
+
+static void bdos_load(void) {
+    uint8_t page[256];
+
+    memcpy(page, bdos_sys, 256);
+    page[6] = 0xdb;                 // IN d8, trap BDOS
+    page[8] = 0xc9;                 // RET if BDOS function was intercepted
+    mem_load(BDOS, page, 256);
+    mem_load(BDOS+256, bdos_sys+256, bdos_sys_len-256);
+}
+
+#ifdef SESSIONS
+
+// What every machine loads, before the sessions are forked
+
+static void system_load(void) {
+    mem_load(BIOS, bios_sys, bios_sys_len);
+    bdos_load();
+    mem_load(CPMB, ccp_sys, ccp_sys_len);
+}
+#endif
+
+// -------------------------------------------------------------------------
+// Hypercalls. OUT ports from HCALL_PORT up do on the host what programs
+// otherwise do a byte or a bit at a time. machine_init() puts a table with
+// an entry for each of them behind the disk tables of the BIOS, an OUT and
+// a RET like the BIOS entries. Warm boot puts where it is in page zero, in
+// bytes that CP/M keeps for the BIOS:
+//
+//      0040    'HC'            signature
+//      0042    1               version
+//      0043    count           number of entries
+//      0044    table           address of entry 0
+//
+// Programs look for the signature and CALL table+3*n, see utils/HCALL.LIB,
+// so they still run where there are no hypercalls, like on the Atari. An
+// OUT to a port without a hypercall stops the emulator, as it does for
+// BIOS functions that do not exist.
+//
+//      n  port  in                         out
+//      0  80H   HL source, DE destination, HL and DE after the bytes, BC 0.
+//               BC count                   Overlapping is fine (memmove)
+//      1  81H   HL destination, BC count,  HL after the bytes, BC 0
+//               A byte
+//      2  82H   HL, DE                     DE:HL = HL * DE
+//      3  83H   HL, DE                     HL = HL / DE, DE = HL % DE and
+//                                          carry clear, or carry set if DE
+//                                          is 0
+//      4  84H   HL string, BC length       HL after the string, BC 0
+//      5  85H   DE 4 bytes                 days since 1977 (1 is 1 January
+//                                          1978), hour and minute in BCD
+//                                          at DE, second in BCD in A
+//      6  86H   -                          DE:HL host time in milliseconds
+//
+// Like CP/M 3, the time is local. Numbers are unsigned. The other
+// registers and the flags, except the carry of 83H, are not changed, and
+// a hypercall counts as one instruction. The host time is recorded and
+// replayed like console input.
+
+#define HCALL_PORT      0x80
+#define HCALL_HEADER    0x0040
+
+enum {
+    HCALL_MOVE,
+    HCALL_FILL,
+    HCALL_MUL,
+    HCALL_DIV,
+    HCALL_PRINT,
+    HCALL_TIME,
+    HCALL_TICKS,
+    NHCALLS
+};
+
+static uint16_t hcall_table;        // 0 without one
+
+static uint8_t *const hcall_ram = &mem[0][0];   // the banks are in a row
+
+// Builds the table at adr, returns the address after it
+
+static uint16_t hcall_init(uint16_t adr) {
+    uint8_t table[3*NHCALLS];
+
+    for (int i=0; i<NHCALLS; i++) {
+        table[3*i] = 0xd3;          // OUT port
+        table[3*i+1] = HCALL_PORT + i;
+        table[3*i+2] = 0xc9;        // RET
     }
-    fprintf(stderr, "\n");
+    mem_load(adr, table, sizeof(table));
+    hcall_table = adr;
+    return adr + sizeof(table);
+}
+
+static void hcall_header(void) {
+    uint8_t header[6] = { 'H', 'C', 1, NHCALLS,
+                          hcall_table & 0xff, hcall_table >> 8 };
+
+    if (hcall_table)
+        memcpy(&mem[0][HCALL_HEADER], header, sizeof(header));
+}
+
+static void hcall_written(uint16_t adr, int n) {
+    for (int i=0; i<n; i++) {
+        aot_write_hook((uint16_t) (adr+i));
+        lockstep_touch(adr+i);
+        reverse_touch(adr+i);
+        reverse_write((uint16_t) (adr+i), (PCH<<8) | PCL);
     }
 }
 
-#else
+static void hcall_move(uint16_t dst, uint16_t src, int n) {
+    if (dst + n <= 0x10000 && src + n <= 0x10000)
+        memmove(hcall_ram + dst, hcall_ram + src, n);
+    else if ((uint16_t) (dst - src) < n)    // ahead, around the top
+        for (int i=n-1; i>=0; i--)
+            hcall_ram[(uint16_t) (dst+i)] = hcall_ram[(uint16_t) (src+i)];
+    else
+        for (int i=0; i<n; i++)
+            hcall_ram[(uint16_t) (dst+i)] = hcall_ram[(uint16_t) (src+i)];
+    hcall_written(dst, n);
+}
 
-#define debug_print_cpu_state()
-#define debug_print_instruction()
+static void hcall_fill(uint16_t dst, uint8_t value, int n) {
+    if (dst + n <= 0x10000)
+        memset(hcall_ram + dst, value, n);
+    else
+        for (int i=0; i<n; i++)
+            hcall_ram[(uint16_t) (dst+i)] = value;
+    hcall_written(dst, n);
+}
 
-#endif
+// kind is 't' for the time of day, 'm' for milliseconds
 
-static void print_bdos_serial() {
-    fprintf(stderr, "BDOS serial: ");
-    for (int i=0; i<6; i++)
-        fprintf(stderr, "%02X ", mem[3][(BDOS&0x3fff)+i]);
-    fprintf(stderr, "\n");
+static int hcall_input(int kind, int value) {
+    return console_input(replay_file ? replay_input(kind)
+                                     : record_input(kind, value));
 }
 
-// -------------------------------------------------------------------------
+static uint8_t hcall_bcd(int x) {
+    return (x / 10) << 4 | x % 10;
+}
 
-static void mem_write(uint8_t LOW, uint8_t HIGH, uint8_t VAL);
-static uint8_t mem_read(uint8_t LOW, uint8_t HIGH);
-static int kbhit();
+static void hcall_entry(int n) {
+    uint16_t hl = (H<<8) | L, de = (D<<8) | E, bc = (B<<8) | C;
+    uint32_t x;
 
-static uint16_t dma_address;
-static uint16_t drive_number;
-static uint16_t track_number;
-static uint16_t sector_number;
-static FILE *dsk[2];
+    lockstep_sync(LOCKSTEP_TRAP);
+
+    switch (n) {
+    case HCALL_MOVE:
+        hcall_move(de, hl, bc);
+        hl += bc;
+        de += bc;
+        bc = 0;
+        break;
+    case HCALL_FILL:
+        hcall_fill(hl, A, bc);
+        hl += bc;
+        bc = 0;
+        break;
+    case HCALL_MUL:
+        x = (uint32_t) hl * de;
+        hl = x;
+        de = x >> 16;
+        break;
+    case HCALL_DIV:
+        if (!de) {
+            F |= CF_FLAG;
+            break;
+        }
+        x = hl;
+        hl = x / de;
+        de = x % de;
+        F &= ~CF_FLAG;
+        break;
+    case HCALL_PRINT:
+        for (int i=0; i<bc; i++)
+            console_putchar(hcall_ram[(uint16_t) (hl+i)]);
+        fflush(stdout);
+        hl += bc;
+        bc = 0;
+        break;
+    case HCALL_TIME: {              // seconds since 1978, local
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        int t = hcall_input('t', now + tm.tm_gmtoff - 252460800);
+        uint8_t date[4] = { (t / 86400 + 1) & 0xff, (t / 86400 + 1) >> 8,
+                            hcall_bcd(t / 3600 % 24), hcall_bcd(t / 60 % 60) };
+        for (int i=0; i<4; i++)
+            hcall_ram[(uint16_t) (de+i)] = date[i];
+        hcall_written(de, 4);
+        A = hcall_bcd(t % 60);
+        break; }
+    case HCALL_TICKS: {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        x = hcall_input('m', t.tv_sec * 1000 + t.tv_nsec / 1000000);
+        hl = x;
+        de = x >> 16;
+        break; }
+    default:
+        fprintf(stderr, "no hypercall at port %02X\n", HCALL_PORT + n);
+        exit(1);
+    }
+    H = hl >> 8;
+    L = hl & 0xff;
+    D = de >> 8;
+    E = de & 0xff;
+    B = bc >> 8;
+    C = bc & 0xff;
+}
 
 static void bios_entry(int function) {
     int r;
 
+    if (function < 17)
+        bios_calls[function]++;
+    lockstep_sync(LOCKSTEP_TRAP);
+    trace_bios_begin(function);
+
     switch (function) {
 
     case 0:         // boot
 //        memcpy(&mem[3][CPMB & 0x3fff], ccp_sys, ccp_sys_len);
-        memcpy(&mem[3][BDOS & 0x3fff], bdos_sys, bdos_sys_len);
+        bdos_load();
 
-        printf("\r\n64k CP/M vers 2.2\r\n");
+        if (!console_quiet())
+            printf("\r\n64k CP/M vers 2.2\r\n");
 
         mem[0][0x0000] = 0xc3;   // JMP $FA03 WBOOT
         mem[0][0x0001] = WBOOTF & 0xff;
@@ -260,20 +2572,23 @@ static void bios_entry(int function) {
         mem[0][0x0006] = BDOSJMP & 0xff;
         mem[0][0x0007] = BDOSJMP >> 8;
 
-        mem[3][(BDOS&0x3fff)+6] = 0xdb; // IN d8, trap BDOS
-        mem[3][(BDOS&0x3fff)+8] = 0xc9; // RET if BDOS function was intercepted
+        trace_patch();
 
         [[fallthrough]];
 
     case 1:         // wboot
         biosprintf("BIOS: WBOOT\n");
+        callprof_reset();
+        lockstep_touch_all();
+        reverse_touch_all();
 
 #ifdef DEBUG
         if (wbootcnt==1) cpudump++; else wbootcnt++;
 #endif
 
         // reload CCP
-        memcpy(&mem[3][CPMB & 0x3fff], ccp_sys, ccp_sys_len);
+        mem_load(CPMB, ccp_sys, ccp_sys_len);
+        hcall_header();
 #ifdef DEBUG
         print_bdos_serial();
 #endif
@@ -289,19 +2604,18 @@ static void bios_entry(int function) {
         break;
 
     case 2:         // const
-        if (kbhit())
+        if (console_status())
             A = 0xff;
         else
             A = 0;      // no pending key, 0xff = pending
         break;
 
     case 3:         // conin
-        A = getchar();
+        A = console_getchar();
         if (A == 127) A = 8;
 #ifdef CTRL_X_IS_EXIT
         if (A == 24) {      // ^X to exit emulator
-            fclose(dsk[0]);
-            fclose(dsk[1]);
+            disk_close();
             exit(0);
         }
 #endif
@@ -309,7 +2623,7 @@ static void bios_entry(int function) {
 
     case 4:         // conout
 //        printf("[32m%c[0m", C);     // we want some colors.
-        putchar(C);
+        console_putchar(C);
         fflush(stdout);
         break;
 
@@ -331,14 +2645,10 @@ static void bios_entry(int function) {
     case 9:         // seldsk
         H = 0;
         L = 0;
-        if (C == 0) {
+        if (C < NDRIVES && disk_select(C)) {
             drive_number = C;
-            H = DPBASE >> 8;    // return dpbase in HL
-            L = DPBASE & 0xff;
-        } else if (C == 1) {
-            drive_number = C;
-            H = (DPBASE+16) >> 8;    // return dpbase in HL
-            L = (DPBASE+16) & 0xff;
+            H = dsk[C].dph >> 8;    // return dpbase in HL
+            L = dsk[C].dph & 0xff;
         }
         break;
 
@@ -357,19 +2667,35 @@ static void bios_entry(int function) {
         break;
 
     case 13: {      // read
-                    // hardcoded 18 sectors per track for atarihd format
-        int abssec = track_number * 18 + sector_number;
+        int abssec = track_number * dsk[drive_number].spt + sector_number;
         int adr = dma_address;
-        if (fseek(dsk[drive_number], abssec*128, SEEK_SET) == EINVAL) {
-            A = 1;
-            break;
+        uint8_t sector[128];
+        int n = replay_sector(sector);
+        if (n < 0) {
+            struct timespec t;
+            clock_gettime(CLOCK_MONOTONIC, &t);
+            n = cache_read(drive_number, abssec, sector);
+            latency(disk_read_ns, &t);
+            if (n < 0) {
+                A = 1;
+                break;
+            }
         }
+        aot_load_hook(adr);
+        disk_read_bytes += n;
+        record_sector(sector, n);
         if ((adr & 0x3fff) <= 0x3f80) {
             int bnk = adr>>(8+6);
-            int ret = fread(&mem[bnk][adr&0x3fff], 1, 128, dsk[drive_number]);
+            memcpy(&mem[bnk][adr&0x3fff], sector, n);
+            for (int i=0; i<n; i++) {
+                aot_write_hook(adr+i);
+                lockstep_touch(adr+i);
+                reverse_touch(adr+i);
+                reverse_write(adr+i, (PCH<<8) | PCL);
+            }
         } else {
-            for (int i=0; i<128; i++) {
-                mem_write(adr&0xff, adr>>8, fgetc(dsk[drive_number]));
+            for (int i=0; i<n; i++) {
+                mem_write(adr&0xff, adr>>8, sector[i]);
                 adr++;
             }
         }
@@ -377,25 +2703,28 @@ static void bios_entry(int function) {
         break; }
 
     case 14: {      // write
-        int abssec = track_number * 18 + sector_number;
+        int abssec = track_number * dsk[drive_number].spt + sector_number;
         int adr = dma_address;
-        if (fseek(dsk[drive_number], abssec*128, SEEK_SET) == EINVAL) {
-            biosprintf("FAILED\n");
-            A = 1;
-            break;
-        }
+        uint8_t sector[128];
+        reverse_disk_write(drive_number, abssec);
+        disk_write_bytes += 128;
         if ((adr & 0x3fff) <= 0x3f80) {
             int bnk = adr>>(8+6);
-            int ret = fwrite(&mem[bnk][adr&0x3fff], 1, 128, dsk[drive_number]);
+            memcpy(sector, &mem[bnk][adr&0x3fff], 128);
         } else {
             for (int i=0; i<128; i++) {
-                if (fputc(mem_read(adr&0xff, adr>>8), dsk[drive_number]) < 0) {
-                    fprintf(stderr, "WRITE ERROR\n");
-                    exit(0);
-                }
+                sector[i] = mem_read(adr&0xff, adr>>8);
                 adr++;
             }
         }
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        if (cache_write(drive_number, abssec, sector) < 0) {
+            biosprintf("FAILED\n");
+            A = 1;
+            break;
+        }
+        latency(disk_write_ns, &t);
         biosprintf("OK\n");
         A = 0;
         break; }
@@ -414,47 +2743,58 @@ static void bios_entry(int function) {
         exit(1);
         break;
     }
+    trace_bios_end();
 }
 
 // -------------------------------------------------------------------------
 
-static void bdos_entry(uint8_t dummy) {
+static void bdos_entry(uint8_t port) {
+    if (port == TRACE_RETURN) {         // retmon, see trace_patch()
+        A = L;
+        B = H;
+        trace_bdos_end(0);
+        return;
+    }
+    bdos_calls[C]++;
+    lockstep_sync(LOCKSTEP_TRAP);
+    trace_bdos_begin();
+
     switch(C) {
     case 9: {   // C_WRITESTR
             int addr = (D<<8) | E;
             int t;
             while ((t = mem[D>>6][addr&0x3fff]) != '$') {
-                putchar(t);
+                console_putchar(t);
                 addr++;
             }
         }
         break;
     case 1: // C_READ
-        A = L = getchar();
+        A = L = console_getchar();
         if (A == 127) A = 8;
         //putchar('.');
-        putchar(A);
+        console_putchar(A);
         break;
     case 6:     // C_RAWIO (this is what Zork 1 uses)
         if (E==0xff) {
-            if (kbhit()) {
-                A = L = getchar();
+            if (console_ready()) {
+                A = L = console_getchar();
             } else {
                 A = L = 0;
             }
 #ifdef CTRL_X_IS_EXIT
             if (A == 24) {      // ^X to exit emulator
-                fclose(dsk[0]);
-                fclose(dsk[1]);
+                disk_close();
                 exit(0);
             }
+            trace_bdos_end(1);
             return;
 #endif
         }
         [[fallthrough]];
     case 2: // C_WRITE
         //putchar(',');
-        putchar(E);
+        console_putchar(E);
         fflush(stdout);
         break;
     default:
@@ -462,16 +2802,22 @@ static void bdos_entry(uint8_t dummy) {
         PCH = BDOSE >> 8;
         PCHa = PCH & 0x3f;
         curbank = 3;
-        break;
+        return;
     }
+    trace_bdos_end(1);
 }
 
 // -------------------------------------------------------------------------
 
 static inline void increment_PC(void) {
+#ifdef ATARI_REGS
     PCL++;
     if (PCL == 0) {
         PCH++;                      // skip on atari, calculate when needed
+#else
+    PC++;
+    if (PCL == 0) {
+#endif
         PCHa++;
         if (PCHa == 0x40) {         // 0x80 on Atari, end of bank, BIT!
             PCHa = 0;
@@ -480,7 +2826,7 @@ static inline void increment_PC(void) {
     }
 }
 
-static void get_instruction(void) {
+static inline __attribute__((always_inline)) void get_instruction(void) {
     // Atari: emulation code MUST live outside the 16kB window
     // The proper bank should always be selected, enforced by increment_PC
     // All instructions that change the PC (CALLs, RETs, JMPs) MUST do
@@ -488,8 +2834,11 @@ static void get_instruction(void) {
 
     debug_print_cpu_state();
 
+    uint16_t pc = (PCH<<8) | PCL;
+
     instruction = mem[curbank][(PCHa<<8) | PCL];
     increment_PC();
+    icount++;
 
     int len = instruction_length[instruction];
 
@@ -503,8 +2852,44 @@ static void get_instruction(void) {
     }
 
     debug_print_instruction();
+    lockstep_trace(pc);
+    lockstep_sync(LOCKSTEP_INSN);
+    reverse_instruction(pc);
+    profile_instruction(pc);
+    callprof_instruction();
+    coverage_instruction(pc);
 }
 
+#ifdef SUPEROPS
+
+// Fetch the next instruction of a fused sequence. Its opcode, and thus its
+// length, is already known. Debug and profile builds take the long way, so
+// they still see every instruction.
+
+#if defined(DEBUG) || defined(PROFILE) || defined(CALLPROF) || defined(COVERAGE)
+#define SUPEROP_FETCH1()    get_instruction()
+#define SUPEROP_FETCH2()    get_instruction()
+#define SUPEROP_FETCH3()    get_instruction()
+#else
+#define SUPEROP_FETCH1() \
+    increment_PC(); \
+    icount++;
+#define SUPEROP_FETCH2() \
+    increment_PC(); \
+    icount++; \
+    byte2 = mem[curbank][(PCHa<<8) | PCL]; \
+    increment_PC();
+#define SUPEROP_FETCH3() \
+    increment_PC(); \
+    icount++; \
+    byte2 = mem[curbank][(PCHa<<8) | PCL]; \
+    increment_PC(); \
+    byte3 = mem[curbank][(PCHa<<8) | PCL]; \
+    increment_PC();
+#endif
+
+#endif
+
 // Emulate 64kB banked RAM.
 //
 // Atari: these are less frequent than instruction fetch, so save and restore
@@ -526,6 +2911,7 @@ static void mem_write(uint8_t LOW, uint8_t HIGH, uint8_t VAL) {
 #endif
 
     uint8_t savebank = curbank;
+    coverage_write(adr, savebank);
                                     // atari: here is where we adjust B, D, H
     curbank = HIGH>>6;              // table lookup
     HIGH &= 0x3f;
@@ -533,12 +2919,17 @@ static void mem_write(uint8_t LOW, uint8_t HIGH, uint8_t VAL) {
     uint16_t ADR = (HIGH<<8) | LOW;
 
     mem[curbank][ADR] = VAL;        // sta (adr),y
+    aot_write_hook(adr);
+    lockstep_touch(adr);
+    reverse_touch(adr);
+    reverse_write(adr, pc);
 
     curbank = savebank;
 }
 
 static uint8_t mem_read(uint8_t LOW, uint8_t HIGH) {
     uint8_t savebank = curbank;
+    coverage_read((HIGH<<8) | LOW, savebank);
                                     // atari: here is where we adjust B, D, H
     curbank = HIGH>>6;              // table lookup
     HIGH &= 0x3f;
@@ -563,13 +2954,44 @@ static uint8_t mem_read(uint8_t LOW, uint8_t HIGH) {
 #define SET_PF(expr)    if(expr) F |= PF_FLAG; else F &= ~PF_FLAG;
 #define GET_PF()        (F&PF_FLAG)
 
-#define SET_ZSP(VAL) \
-    F &= ~(ZF_FLAG | SF_FLAG | PF_FLAG); \
-    F |=  zsp_table[VAL];
+#define SET_ZSP(VAL) \
+    F &= ~(ZF_FLAG | SF_FLAG | PF_FLAG); \
+    F |=  zsp_table[VAL];
+
+// -------------------------------------------------------------------------
+
+#ifdef IDIOMS
+
+// Block copy, fill, sum, search and compare loops, see idiom_run(). They
+// end in a jump back to their first instruction, by exactly their length.
+// idiom_lengths[] has for each first opcode of idioms[] bit 1 << length
+// set, which keeps the check after every jump cheap.
+
+#if defined(DEBUG) || defined(PROFILE) || defined(CALLPROF) || defined(COVERAGE) || defined(REVERSE)
+#undef IDIOMS                       // they see every instruction
+#else
+static const uint16_t idiom_lengths[256] = {
+    [0x05] = 1 << 9,                // DCR B, IDIOM_MOVE
+    [0x0d] = 1 << 9,                // DCR C, IDIOM_MOVE
+    [0x1a] = 1 << 8 | 1 << 11,      // IDIOM_COPY_DE, IDIOM_COMPARE
+    [0x36] = 1 << 7,                // IDIOM_FILL
+    [0x77] = 1 << 6,                // IDIOM_FILL_A
+    [0x7e] = 1 << 8,                // IDIOM_COPY_HL
+    [0x86] = 1 << 6,                // IDIOM_SUM
+    [0xbe] = 1 << 9,                // IDIOM_SEARCH
+};
+
+static void idiom_run(void);
+#endif
+
+#endif
+
+// Inside the run loop, writes go past the watchpoints first
 
-// -------------------------------------------------------------------------
+#define mem_write(LOW, HIGH, VAL) \
+    (instrumented ? instrument_write(LOW, HIGH, VAL) : mem_write(LOW, HIGH, VAL))
 
-static void run_emulator(void) {
+static inline __attribute__((always_inline)) void run_loop(const int instrumented) {
     int x = 100;
 
     // temporary variables
@@ -578,12 +3000,36 @@ static void run_emulator(void) {
     uint8_t t8, M;
     int16_t t16;
     int32_t t32;
-    uint16_t u16, HL;              // note that this are temporaries and do
+    uint16_t u16, hl;              // note that this are temporaries and do
                                    // not directly reflect the state of the
-                                   // registers! only used by DAD
+                                   // registers! only used by DAD and XCHG
 
     while(1 /*x--*/) {
+        if (run_request)                // see run_emulator()
+            return;
+#ifdef LOCKSTEP
+        if (lockstep_stop || icount >= lockstep_limit) {    // see lockstep8080.c
+            lockstep_stop = 0;
+            return;
+        }
+#endif
+#ifdef REVERSE
+        if (icount >= reverse_next)     // see reverse8080.c
+            return;
+#endif
+#ifdef AOT
+        if (!instrumented && aot_page[PCH]) aot_enter();
+#endif
+        uint16_t pc = (PCH<<8) | PCL;
+
         get_instruction();
+        if (instrumented)
+            instrument_instruction(pc);
+
+#ifdef SUPEROPS
+        if (!instrumented && superop_first[instruction]) goto superop;
+dispatch:
+#endif
 
         switch(instruction) {       // atari jump table
 
@@ -593,7 +3039,11 @@ static void run_emulator(void) {
         // ######################### LXI #########################
         // LXI XY       X <- byte3; Y <- byte2
 
+#ifdef ATARI_REGS
 #define LXI(X,Y) X = byte3; Y = byte2;
+#else
+#define LXI(X,Y) X##Y = byte3 << 8 | byte2;
+#endif
 
         case 0x01: LXI(B,C); break;
         case 0x11: LXI(D,E); break;
@@ -621,7 +3071,11 @@ static void run_emulator(void) {
         // ######################### INX #########################
         // INX XY       XY <- XY+1
 
+#ifdef ATARI_REGS
 #define INX(X,Y) Y++; if (Y == 0) X++;
+#else
+#define INX(X,Y) X##Y++;
+#endif
 
         case 0x03: INX(B,C); break;
         case 0x13: INX(D,E); break;
@@ -671,13 +3125,20 @@ static void run_emulator(void) {
         // ######################### DAD #########################
         // DAD XY                           HL = HL + XY    [CY]
 
+#ifdef ATARI_REGS
 #define DAD(X,Y) \
-            HL = (H<<8) | L; \
+            hl = (H<<8) | L; \
             u16 = (X<<8) | Y; \
-            t32 = HL + u16; \
+            t32 = hl + u16; \
             H = t32 >> 8; \
             L = t32 & 0xff; \
             SET_CF(t32 & 0x00010000);
+#else
+#define DAD(X,Y) \
+            t32 = HL + X##Y; \
+            HL = t32; \
+            SET_CF(t32 & 0x00010000);
+#endif
 
         case 0x09: DAD(B,C); break;
         case 0x19: DAD(D,E); break;
@@ -704,10 +3165,17 @@ static void run_emulator(void) {
 
         // ######################### DCX #########################
         // DCX XY       XY <- XY-1
-        case 0x0b:   C--; if (  C == 0xff) B--; break;
-        case 0x1b:   E--; if (  E == 0xff) D--; break;
-        case 0x2b:   L--; if (  L == 0xff) H--; break;
-        case 0x3b: SPL--; if (SPL == 0xff) SPH--; break;
+
+#ifdef ATARI_REGS
+#define DCX(X,Y) Y--; if (Y == 0xff) X--;
+#else
+#define DCX(X,Y) X##Y--;
+#endif
+
+        case 0x0b: DCX(B,C); break;
+        case 0x1b: DCX(D,E); break;
+        case 0x2b: DCX(H,L); break;
+        case 0x3b: DCX(SPH,SPL); break;
 
         // ######################### RRC/RAR/CMA/CMC #########################
         //
@@ -794,10 +3262,14 @@ static void run_emulator(void) {
         case 0x75: mem_write(L, H, L); break;
 
         case 0x76:
+            lockstep_error(LOCKSTEP_HLT);
+            reverse_stop(REVERSE_HLT);
+#if defined(BENCH) || defined(EXM)
+            return;                 // see bench8080.c and exm8080.c
+#endif
             if (PCH != 0x01 && PCL != 0x00)
                 fprintf(stderr, "HALT PC: %04X\n", ((PCH<<8)|PCL)-1);
-            fclose(dsk[0]);
-            fclose(dsk[1]);
+            disk_close();
             if (PCH>=0xe4 && PCH<0xec) {
                 fprintf(stderr, "serial check on bdos fail --> overwritten\n");
                 print_bdos_serial();
@@ -975,11 +3447,9 @@ static void run_emulator(void) {
 
 #define POP(X,Y) \
             Y = mem_read(SPL, SPH); \
-            SPL++; \
-            if (SPL == 0) SPH++; \
+            INX(SPH,SPL); \
             X = mem_read(SPL, SPH); \
-            SPL++; \
-            if (SPL == 0) SPH++;
+            INX(SPH,SPL);
 
         case 0xc1: POP(B,C); break;
         case 0xd1: POP(D,E); break;
@@ -991,11 +3461,9 @@ static void run_emulator(void) {
 
         // PUSH XY      (SP-2) <- Y; (SP-1) <- X; SP <- SP-2
 #define PUSH(X,Y) \
-            SPL--; \
-            if (SPL == 0xff) SPH--; \
+            DCX(SPH,SPL); \
             mem_write(SPL, SPH, X); \
-            SPL--; \
-            if (SPL == 0xff) SPH--; \
+            DCX(SPH,SPL); \
             mem_write(SPL, SPH, Y);
 
         case 0xc5: PUSH(B,C); break;
@@ -1015,6 +3483,8 @@ static void run_emulator(void) {
         case 0xf8: if ( GET_SF()) goto RET; break;
         case 0xc9: // RET ---- PC.lo <- (SP);PC.hi <- (SP+1);SP <- SP+2
 RET:
+            callprof_ret();
+            lockstep_sync(LOCKSTEP_BLOCK);
             POP(PCH,PCL);
             PCHa = PCH & 0x3f;      // adjust!!
             curbank = PCH>>6;
@@ -1032,10 +3502,19 @@ RET:
         case 0xfa: if ( GET_SF()) goto JMP; break;
         case 0xc3:
 JMP:
+            lockstep_sync(LOCKSTEP_BLOCK);
+#ifdef IDIOMS
+            t16 = ((PCH<<8) | PCL) - ((byte3<<8) | byte2);     // back
+#endif
             PCL = byte2;
             PCH = byte3;
             PCHa = PCH & 0x3f;      // adjust!
             curbank = PCH>>6;
+#ifdef IDIOMS
+            if (!instrumented && (uint16_t) t16 < 16
+                    && idiom_lengths[mem[curbank][(PCHa<<8) | PCL]] >> t16 & 1)
+                idiom_run();
+#endif
             break;
 
         // ######################### CALL/RST #########################
@@ -1051,6 +3530,8 @@ JMP:
         case 0xcd:
 CALL:       
             PUSH(PCH,PCL);
+            callprof_call((byte3<<8) | byte2);
+            lockstep_sync(LOCKSTEP_BLOCK);
             PCL = byte2;
             PCH = byte3;
             PCHa = PCH & 0x3f;      // adjust!
@@ -1083,42 +3564,50 @@ CALL:
             t8 = mem_read(SPL, SPH);
             mem_write(SPL, SPH, L);
             L = t8;
-            SPL++;
-            if (SPL == 0) SPH++;
+            INX(SPH,SPL);
             t8 = mem_read(SPL, SPH);
             mem_write(SPL, SPH, H);
             H = t8;
-            SPL--;
-            if (SPL == 0xff) SPH--; // atari, see if this can be done faster
+            DCX(SPH,SPL);           // atari, see if this can be done faster
             break;
+
+#ifdef ATARI_REGS
+#define XCHG() t8 = H; H = D; D = t8; t8 = L; L = E; E = t8;
+#define SPHL() SPL = L; SPH = H;
+#define PCHL() PCL = L; PCH = H;
+#else
+#define XCHG() u16 = HL; HL = DE; DE = u16;
+#define SPHL() SP = HL;
+#define PCHL() PC = HL;
+#endif
+
         case 0xeb: // XCHG ---- H <-> D;L <-> E
-            t8 = H;
-            H = D;
-            D = t8;
-            t8 = L;
-            L = E;
-            E = t8;
+            XCHG();
             break;
 
         // ######################### PCHL/SPHL #########################
         //
         case 0xe9: // PCHL ---- PC.hi <- H;PC.lo <- L
-            PCL = L;
-            PCH = H;
+            lockstep_sync(LOCKSTEP_BLOCK);
+            PCHL();
             PCHa = PCH & 0x3f;      // adjust!
             curbank = PCH>>6;
             break;
         case 0xf9: // SPHL ---- SP <- HL
-            SPL = L;
-            SPH = H;
+            SPHL();
             break;
 
         // ######################### OUT/IN #########################
         //
         case 0xd3: // OUT d8 ---- OUTput A to device num
-            bios_entry(byte2);
+            lockstep_io();
+            if (byte2 >= HCALL_PORT)
+                hcall_entry(byte2 - HCALL_PORT);
+            else
+                bios_entry(byte2);
             break;
         case 0xdb: // IN d8 ---- INput from device num to A
+            lockstep_io();
             bdos_entry(byte2);
             break;
 
@@ -1141,6 +3630,8 @@ CALL:
         case 0xdd:
         case 0xed:
         case 0xfd:
+            lockstep_error(LOCKSTEP_UNDEFINED);
+            reverse_stop(REVERSE_UNDEFINED);
             printf("CPU: undefined opcode: %02x\n", instruction);
             exit(1);
             break;
@@ -1149,12 +3640,636 @@ CALL:
             exit(1);
             break;
         }
+
+#ifdef SUPEROPS
+        continue;
+
+        // Fused handlers for frequent opcode sequences. Included here so
+        // the instruction macros above are defined. Each handler either
+        // finishes the whole sequence and continues, or goes back to
+        // dispatch to execute the single instruction in the normal way.
+superop:
+#include "tables/superops.h"
+#endif
+    }
+}
+
+#undef mem_write
+
+#ifdef IDIOMS
+
+// -------------------------------------------------------------------------
+
+// Idioms. The 8080 has no block instructions, so programs copy, fill and
+// compare memory a byte at a time, with a counter in a register:
+//
+//      loop:   mov a,m
+//              stax d
+//              inx h
+//              inx d
+//              dcr c
+//              jnz loop
+//
+// When a jump lands on such a loop, idiom_run() does the rest of it at
+// once, with memmove(), memset() or memchr(), and leaves the registers,
+// flags, memory and icount as the last iteration would have. The flags are
+// set by the instruction macros of run_loop(). The loop is left to the
+// interpreter if it would write to its own code.
+
+enum {
+    IDIOM_COPY_HL,
+    IDIOM_COPY_DE,
+    IDIOM_MOVE,
+    IDIOM_FILL,
+    IDIOM_FILL_A,
+    IDIOM_SUM,
+    IDIOM_SEARCH,
+    IDIOM_COMPARE,
+    NIDIOMS
+};
+
+#define IDIOM_DCR   0x100           // DCR of the counter
+#define IDIOM_BYTE  0x200           // an immediate operand
+#define IDIOM_EXIT  0x300           // the address where the loop exits
+#define IDIOM_LOOP  0x400           // the address of the loop, the end
+
+#define IDIOM_BC    (1 << 0 | 1 << 1)
+#define IDIOM_BCDE  (1 << 0 | 1 << 1 | 1 << 2 | 1 << 3)
+
+static const struct idiom {
+    uint16_t code[10];
+    uint8_t counters;               // 1 << register, those that can count
+    uint8_t instructions;           // per iteration
+} idioms[NIDIOMS] = {
+    // MOV A,M; STAX D; INX H; INX D; DCR r; JNZ loop
+    [IDIOM_COPY_HL] = { { 0x7e, 0x12, 0x23, 0x13, IDIOM_DCR, 0xc2,
+                          IDIOM_LOOP }, IDIOM_BC, 6 },
+    // LDAX D; MOV M,A; INX D; INX H; DCR r; JNZ loop
+    [IDIOM_COPY_DE] = { { 0x1a, 0x77, 0x13, 0x23, IDIOM_DCR, 0xc2,
+                          IDIOM_LOOP }, IDIOM_BC, 6 },
+    // DCR r; RZ; LDAX D; MOV M,A; INX D; INX H; JMP loop, move in the BDOS
+    [IDIOM_MOVE] = { { IDIOM_DCR, 0xc8, 0x1a, 0x77, 0x13, 0x23, 0xc3,
+                       IDIOM_LOOP }, IDIOM_BC, 7 },
+    // MVI M,byte; INX H; DCR r; JNZ loop
+    [IDIOM_FILL] = { { 0x36, IDIOM_BYTE, 0x23, IDIOM_DCR, 0xc2, IDIOM_LOOP },
+                     IDIOM_BCDE | 1 << 7, 4 },
+    // MOV M,A; INX H; DCR r; JNZ loop
+    [IDIOM_FILL_A] = { { 0x77, 0x23, IDIOM_DCR, 0xc2, IDIOM_LOOP },
+                       IDIOM_BCDE, 4 },
+    // ADD M; INX H; DCR r; JNZ loop
+    [IDIOM_SUM] = { { 0x86, 0x23, IDIOM_DCR, 0xc2, IDIOM_LOOP },
+                    IDIOM_BCDE, 4 },
+    // CMP M; JZ exit; INX H; DCR r; JNZ loop
+    [IDIOM_SEARCH] = { { 0xbe, 0xca, IDIOM_EXIT, 0x23, IDIOM_DCR, 0xc2,
+                         IDIOM_LOOP }, IDIOM_BCDE, 5 },
+    // LDAX D; CMP M; JNZ exit; INX D; INX H; DCR r; JNZ loop
+    [IDIOM_COMPARE] = { { 0x1a, 0xbe, 0xc2, IDIOM_EXIT, 0x13, 0x23,
+                          IDIOM_DCR, 0xc2, IDIOM_LOOP }, IDIOM_BC, 7 },
+};
+
+struct idiom_loop {
+    int kind, len;
+    uint8_t *counter;
+    uint8_t byte;
+    uint16_t exit;
+};
+
+#define RAM     ((uint8_t *) mem)   // the four banks are 64kB in a row
+
+static uint8_t *const idiom_registers[8] = {
+    &B, &C, &D, &E, &H, &L, NULL, &A
+};
+
+static int idiom_match(uint16_t adr, struct idiom_loop *l) {
+    for (l->kind=0; l->kind<NIDIOMS; l->kind++) {
+        const uint16_t *code = idioms[l->kind].code;
+        int i = 0, ok = 1;
+
+        for (int j=0; ok; j++) {
+            uint8_t b = RAM[(uint16_t) (adr+i)];
+            uint16_t w = b | RAM[(uint16_t) (adr+i+1)] << 8;
+
+            if (code[j] == IDIOM_LOOP) {
+                ok = w == adr;
+                i += 2;
+                break;
+            }
+            switch (code[j]) {
+            case IDIOM_DCR:
+                ok = (b & 0xc7) == 0x05
+                  && (idioms[l->kind].counters >> (b >> 3 & 7) & 1);
+                l->counter = idiom_registers[b >> 3 & 7];
+                i++;
+                break;
+            case IDIOM_BYTE:
+                l->byte = b;
+                i++;
+                break;
+            case IDIOM_EXIT:
+                l->exit = w;
+                i += 2;
+                break;
+            default:
+                ok = b == code[j];
+                i++;
+                break;
+            }
+        }
+        if (ok) {
+            l->len = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whether writing n bytes at adr would change the loop
+
+static int idiom_overlaps(uint16_t adr, int n, uint16_t loop, int len) {
+    return (uint16_t) (loop - adr) < n || (uint16_t) (adr - loop) < len;
+}
+
+static void idiom_written(uint16_t adr, int n) {
+    for (int i=0; i<n; i++) {
+        aot_write_hook((uint16_t) (adr+i));
+        lockstep_touch(adr+i);
+    }
+}
+
+// A byte at a time, like the loop, when the destination is a little ahead
+// of the source and the copy repeats a pattern
+
+static void idiom_copy(uint16_t dst, uint16_t src, int n) {
+    uint16_t ahead = dst - src;
+
+    if ((ahead == 0 || ahead >= n) && dst + n <= 0x10000 && src + n <= 0x10000)
+        memmove(RAM + dst, RAM + src, n);
+    else
+        for (int i=0; i<n; i++)
+            RAM[(uint16_t) (dst+i)] = RAM[(uint16_t) (src+i)];
+    idiom_written(dst, n);
+}
+
+static void idiom_fill(uint16_t dst, uint8_t value, int n) {
+    if (dst + n <= 0x10000)
+        memset(RAM + dst, value, n);
+    else
+        for (int i=0; i<n; i++)
+            RAM[(uint16_t) (dst+i)] = value;
+    idiom_written(dst, n);
+}
+
+// The index of the first value in n bytes at adr, or n
+
+static int idiom_find(uint16_t adr, uint8_t value, int n) {
+    if (adr + n <= 0x10000) {
+        uint8_t *p = memchr(RAM + adr, value, n);
+        return p ? p - (RAM + adr) : n;
+    }
+    for (int i=0; i<n; i++)
+        if (RAM[(uint16_t) (adr+i)] == value)
+            return i;
+    return n;
+}
+
+static int idiom_mismatch(uint16_t a, uint16_t b, int n) {
+    int i;
+
+    for (i=0; i<n; i++)
+        if (RAM[(uint16_t) (a+i)] != RAM[(uint16_t) (b+i)])
+            break;
+    return i;
+}
+
+static inline void idiom_goto(uint16_t adr) {
+    PCL = adr & 0xff;
+    PCH = adr >> 8;
+    PCHa = PCH & 0x3f;
+    curbank = PCH >> 6;
+}
+
+// The PC is at the first instruction of the loop. Counters of 0 run 256
+// times. The MOVE of the BDOS decrements first and returns at zero, which
+// is left to the interpreter.
+
+static __attribute__((noinline)) void idiom_run(void) {
+    uint16_t loop = (PCH<<8) | PCL, hl = (H<<8) | L, de = (D<<8) | E;
+    struct idiom_loop l = { 0 };
+    int16_t z;
+    uint8_t M;
+    int n, k;
+
+    if (!idiom_match(loop, &l))
+        return;
+    n = *l.counter ? *l.counter : 256;
+
+    switch (l.kind) {
+    case IDIOM_COPY_HL:
+    case IDIOM_COPY_DE:
+    case IDIOM_MOVE:
+        if (l.kind == IDIOM_MOVE && !(n = (*l.counter - 1) & 0xff))
+            return;
+        uint16_t src = l.kind == IDIOM_COPY_HL ? hl : de;
+        uint16_t dst = l.kind == IDIOM_COPY_HL ? de : hl;
+        if (idiom_overlaps(dst, n, loop, l.len))
+            return;
+        idiom_copy(dst, src, n);
+        A = RAM[(uint16_t) (src+n-1)];
+        hl += n;
+        de += n;
+        break;
+    case IDIOM_FILL:
+    case IDIOM_FILL_A:
+        if (idiom_overlaps(hl, n, loop, l.len))
+            return;
+        idiom_fill(hl, l.kind == IDIOM_FILL ? l.byte : A, n);
+        hl += n;
+        break;
+    case IDIOM_SUM:
+        for (int i=0; i<n; i++) {
+            M = RAM[(uint16_t) (hl+i)];
+            ADD(M,0);
+        }
+        hl += n;
+        break;
+    case IDIOM_SEARCH:
+        k = idiom_find(hl, A, n);
+        M = RAM[(uint16_t) (hl+(k < n ? k : n-1))];
+        CMP(M);
+        if (k < n) {
+            hl += k;
+            *l.counter -= k;
+            H = hl >> 8;
+            L = hl & 0xff;
+            icount += k * idioms[l.kind].instructions + 2;
+            idiom_goto(l.exit);
+            return;
+        }
+        hl += n;
+        break;
+    case IDIOM_COMPARE:
+        k = idiom_mismatch(de, hl, n);
+        A = RAM[(uint16_t) (de+(k < n ? k : n-1))];
+        M = RAM[(uint16_t) (hl+(k < n ? k : n-1))];
+        CMP(M);
+        if (k < n) {
+            hl += k;
+            de += k;
+            *l.counter -= k;
+            H = hl >> 8;
+            L = hl & 0xff;
+            D = de >> 8;
+            E = de & 0xff;
+            icount += k * idioms[l.kind].instructions + 3;
+            idiom_goto(l.exit);
+            return;
+        }
+        hl += n;
+        de += n;
+        break;
+    }
+
+    // DCR of the counter in the last iteration, to 1 for MOVE, else to 0
+
+    *l.counter = l.kind == IDIOM_MOVE ? 2 : 1;
+    DCR(*l.counter);
+    H = hl >> 8;
+    L = hl & 0xff;
+    if (l.kind == IDIOM_COPY_HL || l.kind == IDIOM_COPY_DE
+                                || l.kind == IDIOM_MOVE
+                                || l.kind == IDIOM_COMPARE) {
+        D = de >> 8;
+        E = de & 0xff;
+    }
+    icount += n * idioms[l.kind].instructions;
+    if (l.kind != IDIOM_MOVE)
+        idiom_goto(loop + l.len);
+}
+
+#undef RAM
+
+#endif
+
+static __attribute__((noinline)) void run_bare(void) {
+    run_loop(0);
+}
+
+static __attribute__((noinline)) void run_instrumented(void) {
+    run_loop(1);
+}
+
+// Runs the bare or the instrumented loop. Prints or writes the statistics,
+// and switches loops, when asked to. Returns when the loop returns for any
+// other reason.
+
+static void run_emulator(void) {
+    do {
+        if (run_request) {
+            run_request = 0;
+            stats_requests();
+            if (instrument_wanted != instrumented) {
+                instrumented = instrument_wanted;
+                if (instrumented)
+                    instrument_begin();
+                else
+                    instrument_end();
+            }
+        }
+        if (instrumented)
+            run_instrumented();
+        else
+            run_bare();
+    } while (run_request);
+}
+
+#if defined(AOT) && !defined(AOT_MODULE)
+
+// Generated by aot8080 from the programs in AOTCOMS, see the Makefile.
+// Included here so the instruction macros are defined.
+
+#include "aot.c"
+
+static int aot_matches(const struct aot_program *p) {
+    for (int i=0; i<p->len; i++) {
+        int adr = 0x0100 + i;
+        if (mem[adr>>14][adr&0x3fff] != p->image[i])
+            return 0;
+    }
+    return 1;
+}
+
+// -------------------------------------------------------------------------
+
+// Translation cache. Programs that are not built in are translated when the
+// CCP starts them, by running aot8080 and the C compiler, and the shared
+// object is kept in the directory named by ATARI8080_CACHE. The file name
+// is the hash of the image and its load address, so the next run of the
+// same program only has to map it in. The last access time is kept in the
+// modification time, and the least recently used modules are removed when
+// the cache grows beyond ATARI8080_CACHE_SIZE kB (default 65536).
+//
+// Unset ATARI8080_CACHE and only the built in programs are translated.
+
+static const char *aot_cache_dir;
+static long long aot_cache_limit = 65536LL * 1024;
+static int aot_hits, aot_misses, aot_evictions, aot_failures;
+
+static uint64_t aot_hash(const uint8_t *p, int len) {
+    uint64_t h = 0xcbf29ce484222325ULL;         // FNV-1a
+    for (int i=0; i<len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Runs argv without a shell, with standard output to out if it is not -1
+
+static int aot_spawn(char *const argv[], int out) {
+    int status;
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return -1;
+    if (!pid) {
+        if (out >= 0)
+            dup2(out, 1);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) < 0)
+        return -1;
+    return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+// The image, the C code and the module get names of their own next to
+// path, so emulators that translate the same program do not trip over
+// each other. Only the finished module is renamed to path.
+
+static int aot_cache_translate(const uint8_t *image, int len,
+                               const char *path) {
+    char com[1100], src[1100], tmp[1100], abi[64], aot[1100];
+    char *argv[32];
+    int fd[3], n = 0, ret = -1;
+
+    snprintf(com, sizeof(com), "%s-com-XXXXXX", path);
+    snprintf(src, sizeof(src), "%s-c-XXXXXX", path);
+    snprintf(tmp, sizeof(tmp), "%s-so-XXXXXX", path);
+    fd[0] = mkstemp(com);
+    fd[1] = fd[0] < 0 ? -1 : mkstemp(src);
+    fd[2] = fd[1] < 0 ? -1 : mkstemp(tmp);
+    if (fd[2] < 0)
+        goto out;
+
+    if (write(fd[0], image, len) != len)
+        goto out;
+
+    snprintf(aot, sizeof(aot), "%s/aot8080", AOT_DIR);
+    if (aot_spawn((char *[]) { aot, "-m", com, NULL }, fd[1]) < 0)
+        goto out;
+
+    // AOT_CC can be a command with options, like "ccache gcc"
+
+    char cc[256];
+    snprintf(cc, sizeof(cc), "%s", AOT_CC);
+    for (char *w = strtok(cc, " \t"); w && n < 20; w = strtok(NULL, " \t"))
+        argv[n++] = w;
+    snprintf(abi, sizeof(abi), "-DAOT_ABI=%luUL", AOT_ABI);
+    char *const args[] = { "-O2", "-shared", "-fPIC", abi, "-I", AOT_DIR,
+                           "-o", tmp, "-x", "c", src, NULL };
+    memcpy(argv + n, args, sizeof(args));
+    if (n && aot_spawn(argv, -1) == 0 && rename(tmp, path) == 0)
+        ret = 0;
+
+out:
+    for (int i=0; i<3; i++)
+        if (fd[i] >= 0)
+            close(fd[i]);
+    remove(com);
+    remove(src);
+    if (ret < 0)
+        remove(tmp);
+    return ret;
+}
+
+struct aot_cache_entry {
+    char name[64];
+    time_t used;
+    long long size;
+};
+
+static int cmp_cache_entry(const void *a, const void *b) {
+    const struct aot_cache_entry *x = a, *y = b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+static void aot_cache_evict(void) {
+    DIR *d = opendir(aot_cache_dir);
+    if (!d)
+        return;
+
+    struct aot_cache_entry *e = NULL;
+    int n = 0, max = 0;
+    long long total = 0;
+    struct dirent *de;
+    char path[1100];
+
+    while ((de = readdir(d))) {
+        int l = strlen(de->d_name);
+        if (l < 4 || l >= 64 || strcmp(de->d_name + l - 3, ".so"))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", aot_cache_dir, de->d_name);
+        struct stat st;
+        if (stat(path, &st) < 0)
+            continue;
+        if (n == max) {
+            max = max ? max*2 : 64;
+            e = realloc(e, max * sizeof(*e));
+        }
+        strcpy(e[n].name, de->d_name);
+        e[n].used = st.st_mtime;
+        e[n].size = st.st_size;
+        total += st.st_size;
+        n++;
+    }
+    closedir(d);
+
+    qsort(e, n, sizeof(*e), cmp_cache_entry);
+    for (int i=0; i<n && total > aot_cache_limit; i++) {
+        snprintf(path, sizeof(path), "%s/%s", aot_cache_dir, e[i].name);
+        if (remove(path) == 0) {
+            total -= e[i].size;
+            aot_evictions++;
+        }
+    }
+    free(e);
+}
+
+static const struct aot_program *aot_cache_load(void) {
+    static uint8_t image[CPMB - 0x0100];
+    int len = aot_load_top - 0x0100;
+    char path[1024];
+
+    if (!aot_cache_dir || len <= 0)
+        return NULL;
+
+    for (int i=0; i<len; i++) {
+        int adr = 0x0100 + i;
+        image[i] = mem[adr>>14][adr&0x3fff];
+    }
+    snprintf(path, sizeof(path), "%s/%016llx-0100-%04x.so", aot_cache_dir,
+                            (unsigned long long) aot_hash(image, len), len);
+
+    int translated = 0;
+    while (1) {
+        if (access(path, R_OK) < 0) {
+            if (translated || aot_cache_translate(image, len, path) < 0) {
+                aot_failures++;
+                return NULL;
+            }
+            translated = 1;
+            aot_misses++;
+            aot_cache_evict();
+        }
+
+        // The file name could collide, or the module was built by another
+        // version of the emulator. Check before we run it.
+
+        void *handle = dlopen(path, RTLD_LAZY | RTLD_LOCAL);
+        const struct aot_module *m = handle ? dlsym(handle, "aot_module") : NULL;
+        if (m && m->abi == AOT_ABI && m->load == 0x0100
+              && m->program.len == len
+              && !memcmp(m->program.image, image, len)) {
+            if (!translated)
+                aot_hits++;
+            utimes(path, NULL);
+            return &m->program;
+        }
+        if (handle)
+            dlclose(handle);
+        remove(path);
+        if (translated) {
+            aot_failures++;
+            return NULL;
+        }
+    }
+}
+
+static void aot_cache_stats(void) {
+    if (aot_hits + aot_misses)
+        fprintf(stderr, "AOT cache: %d hits, %d misses, %d evicted, "
+                        "%d failed\n", aot_hits, aot_misses, aot_evictions,
+                        aot_failures);
+}
+
+static void aot_cache_init(void) {
+    const char *dir = getenv("ATARI8080_CACHE");
+    const char *size = getenv("ATARI8080_CACHE_SIZE");
+
+    if (!dir || !*dir)
+        return;
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "unable to create %s\n", dir);
+        return;
+    }
+    aot_cache_dir = dir;
+    if (size)
+        aot_cache_limit = atoll(size) * 1024;
+    atexit(aot_cache_stats);
+}
+
+// -------------------------------------------------------------------------
+
+static void aot_use(const struct aot_program *p) {
+    memset(p->bad, 0, p->nblocks);
+    for (int j=0; j<p->len; j++) {
+        aot_block[0x0100+j] = p->blocks[j];
+        if (p->blocks[j])
+            aot_page[(0x0100+j)>>8] = 1;
+    }
+    aot_active = p;
+    biosprintf("AOT: running %s natively\n", p->name);
+}
+
+static void aot_activate(void) {
+    if (aot_active) {
+        memset(&aot_block[0x0100], 0, aot_active->len * sizeof(uint16_t));
+        memset(aot_page, 0, sizeof(aot_page));
+        aot_page[0x01] = 1;
+        aot_active = NULL;
+    }
+
+    for (int i=0; i<sizeof(aot_programs)/sizeof(aot_programs[0]); i++) {
+        if (aot_matches(&aot_programs[i])) {
+            aot_use(&aot_programs[i]);
+            return;
+        }
     }
+
+    const struct aot_program *p = aot_cache_load();
+    if (p)
+        aot_use(p);
+}
+
+// Called from the main loop when the PC is in a page with translated code.
+// Runs native code until it leaves the program or hits something only the
+// interpreter can do. The interpreter then executes at least one
+// instruction before we are back here.
+
+static void aot_enter(void) {
+    uint16_t pc = (PCH<<8) | PCL;
+
+    if (pc == 0x0100)
+        aot_activate();
+    if (aot_active && aot_block[pc] && !instrumented)
+        aot_active->run();
 }
 
+#endif
+
 // -------------------------------------------------------------------------
 
-struct termios orig_termios;
+static struct termios orig_termios;
 static char *CLEAR     = "c";
 
 static void reset_terminal_mode(void) {
@@ -1170,44 +4285,248 @@ static int kbhit() {
     return select(1, &fds, NULL, NULL, &tv) > 0;
 }
 
-int main(int argc, char **argv) {
-    int r;
+#if !defined(AOT_MODULE) && !defined(BENCH) && !defined(EXM)
 
-    memcpy(&mem[3][BIOS&0x3fff], bios_sys, bios_sys_len);
+// Load the BIOS, name the drives, open the input script, and start at
+// cold boot. disks has ndisks names, NULL for no drive. The disks are
+// opened by disk_select().
 
-    if (argc != 3) {
-        fprintf(stderr, "usage: atari8080 disk.img disk2.img\n");
-        return 1;
+static int machine_init(int ndisks, const char **disks) {
+    mem_load(BIOS, bios_sys, bios_sys_len);
+    disk_tables = hcall_init(bios_tables_end());
+    alv_owner = -1;
+
+    for (int i=0; i<ndisks; i++) {
+        memset(&dsk[i], 0, sizeof(dsk[i]));
+        dsk[i].name = disks[i];
+        if (i < 2 && disks[i] && !strncmp(disks[i], "ram:", 4)) {
+            fprintf(stderr, "A: and B: cannot be RAM disks\n");
+            return -1;
+        }
+    }
+    if (!disk_select(0))                // to fail early
+        return -1;
+    atexit(disk_save);
+
+    char *script = getenv("ATARI8080_INPUT");
+    if (script && !console_quiet()) {
+        console_script = fopen(script, "r");
+        if (!console_script) {
+            fprintf(stderr, "unable to open %s\n", script);
+            return -1;
+        }
     }
 
-    for (int i=0; i<2; i++) {
-        dsk[i] = fopen(argv[1+i], "rb+");
-        if (!dsk[i]) {
-            fprintf(stderr, "unable to open %s\n", argv[1+i]);
-            return 1;
+    char *record = getenv("ATARI8080_RECORD");
+    char *replay = getenv("ATARI8080_REPLAY");
+    if (record && !console_quiet()) {
+        record_file = fopen(record, "w");
+        if (!record_file) {
+            fprintf(stderr, "unable to create %s\n", record);
+            return -1;
+        }
+        record_disk = getenv("ATARI8080_RECORD_DISK") != NULL;
+        fprintf(record_file, "atari8080 record%s\n", record_disk ? " disk" : "");
+        atexit(record_close);
+    }
+    if (replay && !console_quiet()) {
+        replay_file = fopen(replay, "r");
+        if (!replay_file || !fgets(replay_line, sizeof(replay_line),
+                                                        replay_file)
+                || strncmp(replay_line, "atari8080 record", 16)) {
+            fprintf(stderr, "unable to replay %s\n", replay);
+            return -1;
+        }
+        replay_disk = strstr(replay_line, " disk") != NULL;
+    }
+
+#ifndef LOCKSTEP                    // the reference would not trace
+    char *calltrace = getenv("ATARI8080_CALLTRACE");
+    if (calltrace && !console_quiet())
+        trace_init(calltrace);
+#endif
+
+    memset(&zp, 0, sizeof(zp));
+    F = ONE_FLAG;
+
+    PCL = BOOTF & 0xff;
+    PCH = BOOTF>>8;
+    PCHa = PCH & 0x3f;
+    curbank = 3;
+    return 0;
+}
+
+#ifdef LOCKSTEP
+
+int LOCKSTEP_FN(LOCKSTEP, init)(int reference, int mode, const char *disk1,
+                                                         const char *disk2) {
+    lockstep_reference = reference;
+    lockstep_mode = mode;
+    const char *disks[2] = { disk1, disk2 };
+    if (machine_init(2, disks) < 0 || !disk_select(1))
+        return -1;                  // both open, the copies are removed
+    return 0;
+}
+
+// Runs until the next stop, returns LOCKSTEP_HLT and so on when it can't
+// go on
+
+int LOCKSTEP_FN(LOCKSTEP, run)(void) {
+    run_emulator();
+    return lockstep_status;
+}
+
+void LOCKSTEP_FN(LOCKSTEP, state)(struct lockstep_state *s) {
+    *s = (struct lockstep_state) {
+        icount, lockstep_status, (PCH<<8) | PCL, (SPH<<8) | SPL,
+        A, F, B, C, D, E, H, L,
+        mem, lockstep_dirty, lockstep_history
+    };
+}
+
+// Start a fuzzing case: clear the pages written by the previous one, put
+// code at 0100H, and set the registers. Memory is all zeros otherwise,
+// there is no BIOS or BDOS, and IN and OUT stop the machine. It runs
+// without stops until the limit.
+
+void LOCKSTEP_FN(LOCKSTEP, load)(const struct lockstep_state *s,
+                                 const uint8_t *code, int len) {
+    uint64_t *dirty = (uint64_t *) lockstep_dirty;
+
+    for (int w=0; w<256/8; w++) {       // usually only a few pages
+        if (!dirty[w])
+            continue;
+        for (int p=w*8; p<w*8+8; p++)
+            if (lockstep_dirty[p])
+                memset(&mem[p>>6][(p&0x3f)<<8], 0, 256);
+        dirty[w] = 0;
+    }
+    memcpy(&mem[0][0x0100], code, len);
+    lockstep_touch(0x0100);             // at most 256 bytes, two pages
+    lockstep_touch(0x0100+len-1);
+
+    A = s->a; B = s->b; C = s->c; D = s->d; E = s->e; H = s->h; L = s->l;
+    F = (s->f | ONE_FLAG) & ALL_FLAGS;
+    SPL = s->sp & 0xff;
+    SPH = s->sp >> 8;
+    PCL = 0x00;
+    PCH = 0x01;
+    PCHa = PCH & 0x3f;
+    curbank = PCH >> 6;
+
+    icount = 0;
+    lockstep_stop = 0;
+    lockstep_status = LOCKSTEP_RUNNING;
+    lockstep_fuzzing = 1;
+    lockstep_mode = LOCKSTEP_TRAP;
+}
+
+void LOCKSTEP_FN(LOCKSTEP, limit)(uint64_t limit) {
+    lockstep_limit = limit;
+}
+
+#elif !defined(REVERSE)
+
+// A drive: X=disk for drive X:, or a disk for the drive after the last
+// one. See disk_open() for what a disk is.
+
+static int drive_arg(const char **disks, int *next, const char *arg) {
+    int drive = *next, named = isalpha(arg[0]) && arg[1] == '=';
+
+    if (named)
+        drive = toupper(arg[0]) - 'A';
+    if (drive >= NDRIVES || !arg[2*named]) {
+        fprintf(stderr, "no such drive: %s\n", arg);
+        return -1;
+    }
+    disks[drive] = arg + 2*named;
+    *next = drive + 1;
+    return 0;
+}
+
+// A file with a drive on every line, # starts a comment
+
+static int drive_file(const char **disks, int *next, const char *name) {
+    char line[4096];
+    FILE *f = fopen(name, "r");
+
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", name);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line + strspn(line, " \t");
+        p[strcspn(p, "#\r\n")] = 0;
+        for (int n = strlen(p); n && isspace(p[n-1]); n--)
+            p[n-1] = 0;
+        if (*p && drive_arg(disks, next, strdup(p)) < 0) {
+            fclose(f);
+            return -1;
         }
     }
+    fclose(f);
+    return 0;
+}
+
+#ifndef SESSIONS
+
+int main(int argc, char **argv) {
+    int r = 0;
+
+    const char *disks[NDRIVES] = { NULL };
+    int next = 0;
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-f") && i+1 < argc)
+            r = drive_file(disks, &next, argv[++i]);
+        else
+            r = drive_arg(disks, &next, argv[i]);
+        if (r < 0)
+            break;
+    }
+    if (argc < 2 || r < 0 || !disks[0]) {
+        fprintf(stderr, "usage: atari8080 [-f drives] [X=]disk ...\n");
+        return 1;
+    }
+
+    if (machine_init(NDRIVES, disks) < 0)
+        return 1;
+
+    stats_init();
+    atexit(stats_dump);
+    signal(SIGUSR2, instrument_signal);
 
     struct termios new_termios;
 
     tcgetattr(0, &orig_termios);
     memcpy(&new_termios, &orig_termios, sizeof(new_termios));
 
+#ifdef AOT
+    aot_cache_init();               // stats are printed after the reset
+#endif
     atexit(reset_terminal_mode);
-    cfmakeraw(&new_termios);
-    tcsetattr(0, TCSANOW, &new_termios);
+#ifdef PROFILE
+    atexit(profile_dump);
+#endif
+#ifdef CALLPROF
+    atexit(callprof_dump);
+#endif
+#ifdef COVERAGE
+    atexit(coverage_dump);
+#endif
+    if (!replay_file) {             // a replay needs no terminal
+        cfmakeraw(&new_termios);
+        tcsetattr(0, TCSANOW, &new_termios);
+    }
 
 //    fputs(CLEAR, stdout);
 //    fflush(stdout);
 
-    memset(&zp, 0, sizeof(zp));
-
-    PCL = BOOTF & 0xff;
-    PCH = BOOTF>>8;
-    PCHa = PCH & 0x3f;
-    curbank = 3;
-
     run_emulator();
 
     return 0;
 }
+
+#endif
+#endif
+#endif
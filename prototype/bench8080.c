@@ -0,0 +1,166 @@
+// -------------------------------------------------------------------------
+//
+// bench8080 - opcode level microbenchmarks
+//
+// Built from atari8080.c once for every engine, see the Makefile, and run
+// by make bench. For every class of instructions it writes a program to
+// 0100H that runs an unrolled body in a loop, times it, and prints the
+// results as JSON. In this build HLT returns from run_emulator().
+//
+// The number of executed instructions is known from the program itself,
+// and includes the loop overhead of two instructions per body. The outer
+// loop counter is 16 bits on top of the stack, as the bodies use all the
+// registers, so that classes of one instruction run TARGET instructions
+// too.
+//
+// -------------------------------------------------------------------------
+
+#define BENCH
+#include "atari8080.c"
+
+#include <time.h>
+
+#if defined(AOT)
+#define ENGINE  "aot"
+#elif defined(SUPEROPS)
+#define ENGINE  "superops"
+#else
+#define ENGINE  "switch"
+#endif
+
+#define UNROLL  32
+#define INNER   256
+#define TARGET  20000000            // instructions per run
+#define RUNS    3                   // report the fastest
+
+enum { PLAIN, NEXT, SUB };          // operand is the next address, or sub
+
+static const struct {
+    const char *name;
+    uint8_t body[8];
+    int len;                        // bytes
+    int count;                      // instructions executed
+    int operand;
+} classes[] = {
+    { "mov_r_r",        { 0x79, 0x4b }, 2, 2, PLAIN },  // MOV A,C ; MOV C,E
+    { "mov_r_m",        { 0x7e }, 1, 1, PLAIN },        // MOV A,M
+    { "mov_m_r",        { 0x77 }, 1, 1, PLAIN },        // MOV M,A
+    { "alu",            { 0x81, 0x8b, 0x91, 0x9b,       // ADD C ... CMP E
+                          0xa1, 0xab, 0xb1, 0xbb }, 8, 8, PLAIN },
+    { "alu_m",          { 0x86, 0x96, 0xa6, 0xbe }, 4, 4, PLAIN },
+    { "alu_imm",        { 0xc6, 0x01, 0xd6, 0x02 }, 4, 2, PLAIN },
+    { "inr_dcr",        { 0x0c, 0x1d }, 2, 2, PLAIN },  // INR C ; DCR E
+    { "push_pop",       { 0xe5, 0xe1 }, 2, 2, PLAIN },  // PUSH H ; POP H
+    { "jcc_taken",      { 0xc2 }, 3, 1, NEXT },         // JNZ $+3
+    { "jcc_not_taken",  { 0xca }, 3, 1, NEXT },         // JZ $+3
+    { "call_ret",       { 0xcd }, 3, 2, SUB },          // CALL sub ; RET
+    { "dad",            { 0x09 }, 1, 1, PLAIN },        // DAD B
+};
+
+static uint16_t here;
+
+static void emit(const uint8_t *bytes, int len) {
+    for (int i=0; i<len; i++, here++)
+        mem[here>>14][here&0x3fff] = bytes[i];
+}
+
+#define EMIT(...) \
+    do { \
+        const uint8_t b_[] = { __VA_ARGS__ }; \
+        emit(b_, sizeof(b_)); \
+    } while (0)
+
+// Returns the number of instructions the program executes.
+
+static uint64_t build(int c, int outer) {
+    uint16_t sub, outer_loop, inner_loop;
+
+    here = 0x0100;
+    EMIT(0x31, 0x00, 0x80);         // LXI SP,8000H
+    EMIT(0x21, outer & 0xff, outer >> 8);               // LXI H,outer
+    EMIT(0xe5);                     // PUSH H
+    EMIT(0x21, 0x00, 0x40);         // LXI H,4000H, data in another bank
+    EMIT(0x3e, 0x01, 0xb7);         // MVI A,1 ; ORA A, so NZ
+
+    sub = 0x0100 + 13 + 2 + UNROLL * classes[c].len + 13;
+
+    outer_loop = here;
+    EMIT(0x06, INNER & 0xff);       // MVI B,0
+    inner_loop = here;
+    for (int i=0; i<UNROLL; i++) {
+        uint8_t body[8];
+        memcpy(body, classes[c].body, classes[c].len);
+        if (classes[c].operand != PLAIN) {
+            uint16_t t = classes[c].operand == NEXT ? here + 3 : sub;
+            body[1] = t & 0xff;
+            body[2] = t >> 8;
+        }
+        emit(body, classes[c].len);
+    }
+    EMIT(0x05);                     // DCR B
+    EMIT(0xc2, inner_loop & 0xff, inner_loop >> 8);     // JNZ inner
+    EMIT(0xe3, 0x2b, 0x7c, 0xb5);   // XTHL ; DCX H ; MOV A,H ; ORA L
+    EMIT(0xe3);                     // XTHL
+    EMIT(0xc2, outer_loop & 0xff, outer_loop >> 8);     // JNZ outer
+    EMIT(0x76);                     // HLT
+    EMIT(0xc9);                     // sub: RET
+
+#ifdef AOT
+    aot_load_top = here;            // as if the CCP loaded it
+#endif
+
+    return 6 + outer * (1 + INNER * (UNROLL * classes[c].count + 2) + 6) + 1;
+}
+
+static double run(void) {
+    struct timespec t0, t1;
+
+    memset(&zp, 0, sizeof(zp));
+    F = ONE_FLAG;
+    PCL = 0x00;
+    PCH = 0x01;
+    PCHa = PCH & 0x3f;
+    curbank = PCH >> 6;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    run_emulator();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int nclasses = sizeof(classes) / sizeof(classes[0]);
+
+#ifdef AOT
+    setenv("ATARI8080_CACHE", "bench-cache", 0);
+    aot_cache_init();
+#endif
+
+    printf("{ \"engine\": \"%s\", \"results\": [\n", ENGINE);
+
+    for (int c=0; c<nclasses; c++) {
+        int per_outer = INNER * (UNROLL * classes[c].count + 2);
+        int outer = TARGET / per_outer;
+        if (outer < 1) outer = 1;
+
+        uint64_t n = build(c, outer);
+        run();                      // warm up (and translate)
+
+        double best = 0;
+        for (int r=0; r<RUNS; r++) {
+            double t = run();
+            if (r == 0 || t < best)
+                best = t;
+        }
+
+        printf("  { \"class\": \"%s\", \"instructions\": %llu, "
+               "\"seconds\": %.6f, \"ns_per_instruction\": %.3f, "
+               "\"mips\": %.2f }%s\n", classes[c].name,
+               (unsigned long long) n, best, best * 1e9 / n,
+               n / best / 1e6, c < nclasses-1 ? "," : "");
+    }
+
+    printf("] }\n");
+    return 0;
+}
@@ -0,0 +1,225 @@
+// -------------------------------------------------------------------------
+//
+// exm8080 - run the test groups of 8080EXM in parallel
+//
+// usage: atari8080-exm [-j jobs] [8080EXM.COM]
+//
+// Built from atari8080.c once for every engine, see the Makefile. The
+// exerciser walks a table of test descriptors, and every group is
+// independent of the others. We boot CP/M, load the program at 0100H and
+// run it up to the first test, which prints the banner. That state is the
+// snapshot. Every group is then run by a forked copy of it, with the table
+// patched to contain only that group, and with HLT at done: so the child
+// stops after its PASS or ERROR line. The parent prints the output of the
+// children in the original order, and finally runs done: itself for the
+// closing message. In this build HLT returns from run_emulator().
+//
+// Exits with 1 if any group did not pass.
+//
+// -------------------------------------------------------------------------
+
+#define EXM
+#include "atari8080.c"
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#if defined(AOT)
+#define ENGINE  "aot"
+#elif defined(SUPEROPS)
+#define ENGINE  "superops"
+#else
+#define ENGINE  "switch"
+#endif
+
+#define START   0x011f              // start: lxi h,tests
+#define MAXTESTS 64
+
+static uint8_t peek(uint16_t adr) {
+    return mem[adr>>14][adr&0x3fff];
+}
+
+// Through mem_write(), so translated code notices the patches.
+
+static void poke(uint16_t adr, uint8_t val) {
+    mem_write(adr & 0xff, adr >> 8, val);
+}
+
+static void run_from(uint16_t adr) {
+    PCL = adr & 0xff;
+    PCH = adr >> 8;
+    PCHa = PCH & 0x3f;
+    curbank = PCH >> 6;
+    run_emulator();
+}
+
+static void copy_output(FILE *f) {
+    char buf[4096];
+    size_t n;
+
+    rewind(f);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        fwrite(buf, 1, n, stdout);
+    fflush(stdout);
+}
+
+static int passed(FILE *f) {
+    char line[256];
+
+    rewind(f);
+    while (fgets(line, sizeof(line), f))
+        if (strstr(line, "PASS!"))
+            return 1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *path = "tests/8080EXM.COM";
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-j") && i+1<argc)
+            jobs = atoi(argv[++i]);
+        else
+            path = argv[i];
+    }
+    if (jobs < 1)
+        jobs = 1;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", path);
+        return 1;
+    }
+    static uint8_t image[CPMB - 0x0100];
+    int len = fread(image, 1, sizeof(image), f);
+    fclose(f);
+    for (i=0; i<len; i++)
+        mem[(0x0100+i)>>14][(0x0100+i)&0x3fff] = image[i];
+
+    // begin: jmp start
+    // start: lhld 6 ; sphl ; lxi d,msg1 ; mvi c,9 ; call bdos
+    //        lxi h,tests
+    // loop:  mov a,m ; inx h ; ora m ; jz done ; ...
+    // done:  lxi d,msg2 ; mvi c,9 ; call bdos ; jmp 0
+
+    uint16_t tests = peek(START + 1) | (peek(START + 2) << 8);
+    uint16_t done = peek(START + 7) | (peek(START + 8) << 8);
+
+    if (len < START + 9 - 0x0100 || peek(0x0100) != 0xc3
+            || peek(START) != 0x21 || peek(START + 6) != 0xca
+            || peek(done) != 0x11 || peek(done + 8) != 0xc3) {
+        fprintf(stderr, "%s does not look like 8080EXM\n", path);
+        return 1;
+    }
+
+    uint16_t group[MAXTESTS];
+    int ngroups = 0;
+    for (uint16_t t = tests; ngroups < MAXTESTS; t += 2) {
+        group[ngroups] = peek(t) | (peek(t+1) << 8);
+        if (!group[ngroups])
+            break;
+        ngroups++;
+    }
+
+    memcpy(&mem[3][BIOS&0x3fff], bios_sys, bios_sys_len);
+    memset(&zp, 0, sizeof(zp));
+    F = ONE_FLAG;
+    bios_entry(0);                  // page zero and BDOS, prints the banner
+    printf("A>%s\r\n", path);
+
+    // run up to the first test, that's the snapshot. We start after the
+    // jmp start at 0100H, because in atari8080-aot that's where the image
+    // is compared to the translations, and it has been patched by then.
+
+#ifdef AOT
+    aot_load_top = 0x0100 + ((len + 127) & ~127);   // as if the CCP loaded it
+    aot_cache_init();
+    aot_activate();
+#endif
+
+    uint8_t saved = peek(START);
+    poke(START, 0x76);
+    run_from(peek(0x0101) | (peek(0x0102) << 8));
+    poke(START, saved);
+    poke(done, 0x76);
+    fflush(stdout);
+
+    // one child per group, at most jobs at a time
+
+    FILE *out[MAXTESTS];
+    pid_t pid[MAXTESTS];
+    int status[MAXTESTS];
+    int started = 0, printed = 0, running = 0, failed = 0;
+
+    for (i=0; i<ngroups; i++)
+        status[i] = -1;
+
+    while (printed < ngroups) {
+        while (started < ngroups && running < jobs) {
+            out[started] = tmpfile();
+            if (!out[started]) {
+                perror("tmpfile");
+                return 1;
+            }
+            pid[started] = fork();
+            if (pid[started] < 0) {
+                perror("fork");
+                return 1;
+            }
+            if (!pid[started]) {
+                dup2(fileno(out[started]), 1);
+                poke(tests, group[started] & 0xff);
+                poke(tests+1, group[started] >> 8);
+                poke(tests+2, 0);
+                poke(tests+3, 0);
+                run_from(START);
+                fflush(stdout);
+                _exit(0);
+            }
+            started++;
+            running++;
+        }
+
+        int st;
+        pid_t p = wait(&st);
+        if (p < 0) {
+            perror("wait");
+            return 1;
+        }
+        for (i=0; i<started; i++)
+            if (pid[i] == p)
+                status[i] = st;
+        running--;
+
+        // print in order, as soon as all earlier groups are done
+
+        while (printed < started && status[printed] >= 0) {
+            copy_output(out[printed]);
+            if (!WIFEXITED(status[printed]) || WEXITSTATUS(status[printed])
+                                            || !passed(out[printed])) {
+                failed++;
+                if (!WIFEXITED(status[printed]) || WEXITSTATUS(status[printed]))
+                    printf("  group %d (%04X) did not finish\r\n", printed,
+                                                            group[printed]);
+            }
+            fclose(out[printed]);
+            printed++;
+        }
+    }
+
+    // and the closing message
+
+    poke(done, 0x11);
+    poke(done + 8, 0x76);
+    poke(tests, 0);
+    poke(tests+1, 0);
+    run_from(START);
+    printf("\r\n");
+    fflush(stdout);
+
+    fprintf(stderr, "exm8080: %s, %d groups on %d jobs, %d failed\n",
+                                            ENGINE, ngroups, jobs, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+// -------------------------------------------------------------------------
+//
+// fuzz8080 - differential fuzzing of the CPU core
+//
+// usage: atari8080-fuzz [-s seed] [-n cases] [-b budget] [-m] [case...]
+//
+// Built from lockstep8080.c, with the same two machines: the reference
+// switch core and the superinstruction engine. Every case is a short
+// program at 0100H with random registers, in otherwise empty memory. Both
+// machines run it until HLT, IN, OUT or an undefined opcode, or until the
+// budget of instructions (64) is used up, and must end up in the same
+// state. Between cases only the pages that were written are cleared.
+//
+// Without files, cases are random. Files are cases to run again, as
+// written when a difference is found, or with -m, seeds to mutate.
+//
+// A case is 10 bytes of registers, A F B C D E H L SPL SPH, followed by
+// the code.
+//
+// -------------------------------------------------------------------------
+
+#define FUZZ
+#include "lockstep8080.c"
+
+#include <time.h>
+
+#define MAXCODE 256
+#define REGS    10
+
+static uint64_t rng_state;
+
+static uint64_t rng(void) {             // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+// Random code, but jumps and calls mostly go somewhere inside it, and
+// most memory operands point at the code or at the page after it.
+
+static int generate(uint8_t *c) {
+    int len = REGS + 1 + rng() % 48;
+
+    for (int i=0; i<len; i++)
+        c[i] = rng();
+    if (rng() & 1)
+        c[9] = 0x02;                    // the stack in the page after it
+
+    for (int i=REGS; i<len; ) {
+        int o = c[i];
+        int n = instruction_length[o];
+        if (n == 3 && i+2 < len && (rng() & 3)) {
+            uint16_t adr = 0x0100 + rng() % (len - REGS + 256);
+            c[i+1] = adr & 0xff;
+            c[i+2] = adr >> 8;
+        }
+        i += n;
+    }
+    return len;
+}
+
+static int mutate(uint8_t *c, int len) {
+    int n = 1 + rng() % 4;
+
+    while (n--) {
+        int i = rng() % len;
+        switch (rng() % 4) {
+        case 0: c[i] ^= 1 << (rng() % 8); break;
+        case 1: c[i] = rng(); break;
+        case 2:                         // insert
+            if (len < REGS + MAXCODE) {
+                memmove(&c[i+1], &c[i], len - i);
+                c[i] = rng();
+                len++;
+            }
+            break;
+        case 3:                         // delete
+            if (len > REGS + 1) {
+                memmove(&c[i], &c[i+1], len - i - 1);
+                len--;
+            }
+            break;
+        }
+    }
+    return len;
+}
+
+// -------------------------------------------------------------------------
+
+static uint64_t budget = 64;
+static uint64_t reasons[4], out_of_budget;
+
+// Run one case on both machines. Returns why they differ, or NULL.
+
+static const char *fuzz_one(const uint8_t *data, int len,
+                            struct lockstep_state *r,
+                            struct lockstep_state *c) {
+    struct lockstep_state regs = {
+        .a = data[0], .f = data[1], .b = data[2], .c = data[3],
+        .d = data[4], .e = data[5], .h = data[6], .l = data[7],
+        .sp = data[8] | (data[9] << 8)
+    };
+    int rs = 0, cs = 0;
+
+    ref_load(&regs, data + REGS, len - REGS);
+    cand_load(&regs, data + REGS, len - REGS);
+
+    // fused instructions may take the candidate past the budget, the
+    // reference must stop at the same count
+
+    cs = cand_run();
+    cand_state(c);
+    ref_limit(c->icount);
+    rs = ref_run();
+    ref_state(r);
+
+    if (cs)
+        reasons[cs]++;
+    else
+        out_of_budget++;
+
+    if (r->icount != c->icount || rs != cs)
+        return "instruction counts differ";
+    return compare(r, c);
+}
+
+static void save(const uint8_t *data, int len, const char *name) {
+    FILE *f = fopen(name, "wb");
+    if (!f || fwrite(data, 1, len, f) != len)
+        fprintf(stderr, "unable to write %s\n", name);
+    if (f)
+        fclose(f);
+}
+
+static int load(const char *name, uint8_t *data) {
+    FILE *f = fopen(name, "rb");
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", name);
+        return -1;
+    }
+    int len = fread(data, 1, REGS + MAXCODE, f);
+    fclose(f);
+    if (len <= REGS) {
+        fprintf(stderr, "%s is too short\n", name);
+        return -1;
+    }
+    return len;
+}
+
+#define MAXSEEDS 64
+
+int main(int argc, char **argv) {
+    uint64_t seed = time(NULL), cases = 1000000;
+    int mutating = 0, nfiles = 0, i;
+    char *files[MAXSEEDS];
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-s") && i+1<argc)
+            seed = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-n") && i+1<argc)
+            cases = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-b") && i+1<argc)
+            budget = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-m"))
+            mutating = 1;
+        else if (nfiles < MAXSEEDS)
+            files[nfiles++] = argv[i];
+    }
+    if (mutating && !nfiles) {
+        fprintf(stderr, "usage: atari8080-fuzz [-s seed] [-n cases] "
+                        "[-b budget] [-m] [case...]\n");
+        return 1;
+    }
+
+    static uint8_t seeds[MAXSEEDS][REGS + MAXCODE];
+    int seedlen[MAXSEEDS];
+    struct lockstep_state r, c;
+    uint8_t data[REGS + MAXCODE];
+    int history = budget < LOCKSTEP_HISTORY ? budget : LOCKSTEP_HISTORY;
+    const char *why;
+
+    for (i=0; i<nfiles; i++)
+        if ((seedlen[i] = load(files[i], seeds[i])) < 0)
+            return 1;
+
+    if (nfiles && !mutating) {
+        cand_limit(budget);
+        for (i=0; i<nfiles; i++) {
+            if ((why = fuzz_one(seeds[i], seedlen[i], &r, &c))) {
+                fprintf(stderr, "%s:", files[i]);
+                report(why, &r, &c, history);
+            }
+            printf("%s: the same after %llu instructions\n", files[i],
+                                            (unsigned long long) c.icount);
+        }
+        return 0;
+    }
+
+    rng_state = seed * 0x9e3779b97f4a7c15ULL + 1;
+    cand_limit(budget);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (uint64_t n=0; n<cases; n++) {
+        int len;
+        if (mutating) {
+            int s = rng() % nfiles;
+            memcpy(data, seeds[s], seedlen[s]);
+            len = mutate(data, seedlen[s]);
+        } else {
+            len = generate(data);
+        }
+
+        if ((why = fuzz_one(data, len, &r, &c))) {
+            char name[64];
+            snprintf(name, sizeof(name), "fuzz-%llu-%llu.bin",
+                            (unsigned long long) seed, (unsigned long long) n);
+            save(data, len, name);
+            fprintf(stderr, "case %llu of seed %llu, saved as %s:",
+                (unsigned long long) n, (unsigned long long) seed, name);
+            report(why, &r, &c, history);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("%llu cases in %.2f s, %.0f per second, seed %llu\n",
+            (unsigned long long) cases, t, cases / t,
+            (unsigned long long) seed);
+    printf("stopped by HLT %llu, undefined opcode %llu, IN/OUT %llu, "
+           "budget %llu\n", (unsigned long long) reasons[LOCKSTEP_HLT],
+           (unsigned long long) reasons[LOCKSTEP_UNDEFINED],
+           (unsigned long long) reasons[LOCKSTEP_IO],
+           (unsigned long long) out_of_budget);
+    return 0;
+}
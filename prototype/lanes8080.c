@@ -0,0 +1,710 @@
+// -------------------------------------------------------------------------
+//
+// lanes8080 - run one CP/M program on many machines at once
+//
+// usage: atari8080-lanes [-n machines] PROGRAM.COM [tails]
+//
+// For batch jobs that run the same program on different inputs. Every line
+// of tails is the command tail of one machine, as in A>PROGRAM tail, and
+// without it there are -n machines with an empty tail. The output of every
+// machine is printed when its batch has finished, in order.
+//
+// LANES machines run together, one instruction for all of them at a time.
+// Their registers and memory are in structure-of-arrays layout, reg[r][l]
+// and mem[adr][l], so an instruction is a loop over the lanes that the
+// compiler vectorizes, 32 lanes of bytes to an AVX2 register. Only the
+// lanes at the lowest PC run, with the same opcode there; the others are
+// masked and wait. Lanes that took another branch run on their own, the
+// one furthest behind first, until they meet again.
+//
+// There are no disks. The BDOS has console output, console status, input
+// that is always ^Z, and the version. A machine stops at a warm boot, at
+// BDOS function 0, and at HLT, IN, OUT and undefined opcodes.
+//
+// -------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "tables/tables.h"
+
+#ifndef LANES
+#define LANES       32
+#endif
+
+#define SF_FLAG     0b10000000          // as in atari8080.c
+#define ZF_FLAG     0b01000000
+#define AF_FLAG     0b00010000
+#define PF_FLAG     0b00000100
+#define ONE_FLAG    0b00000010
+#define CF_FLAG     0b00000001
+#define ALL_FLAGS   (SF_FLAG | ZF_FLAG | AF_FLAG | PF_FLAG | ONE_FLAG | CF_FLAG)
+#define ZSP_FLAGS   (SF_FLAG | ZF_FLAG | PF_FLAG)
+
+#define BDOS_ENTRY  0xfe06              // at 0006H, the top of the TPA
+
+enum { B, C, D, E, H, L, M, A };        // register codes, M is memory
+
+#define ALIGNED     __attribute__((aligned(32)))
+
+static uint8_t reg[8][LANES] ALIGNED;   // reg[M] is not used
+static uint8_t flags[LANES] ALIGNED;
+static uint16_t pc[LANES] ALIGNED, sp[LANES] ALIGNED;
+static uint8_t mem[65536][LANES] ALIGNED;
+
+static uint8_t live[LANES] ALIGNED;     // not stopped
+static uint8_t on[LANES] ALIGNED;       // run this instruction
+static uint8_t go[LANES] ALIGNED;       // and take its branch
+static uint8_t b2[LANES] ALIGNED, b3[LANES] ALIGNED, val[LANES] ALIGNED;
+static uint16_t adr[LANES] ALIGNED;
+
+static struct {
+    char *buf;
+    size_t len, size;
+} out[LANES];
+
+static uint64_t steps, executed;
+
+#define LANE_LOOP           for (int l=0; l<LANES; l++)
+#define SET(mask, x, v)     x[l] ^= (x[l] ^ (v)) & -(__typeof__(x[l])) mask[l]
+
+// The same as zsp_table[v], but without a lookup for every lane
+
+static inline uint8_t zsp(uint8_t v) {
+    uint8_t p = v ^ (v >> 4);
+    p ^= p >> 2;
+    p ^= p >> 1;
+    return (v & SF_FLAG) | (v ? 0 : ZF_FLAG) | (p & 1 ? 0 : PF_FLAG);
+}
+
+static inline uint16_t hl(int l) {
+    return reg[H][l] << 8 | reg[L][l];
+}
+
+// Register pairs BC, DE, HL and SP, as in bits 4 and 5 of the opcode
+
+static inline uint16_t pair(int rp, int l) {
+    return rp == 3 ? sp[l] : reg[2*rp][l] << 8 | reg[2*rp+1][l];
+}
+
+static void set_pair(int rp, const uint8_t *mask, const uint16_t *v) {
+    if (rp == 3) {
+        LANE_LOOP SET(mask, sp, v[l]);
+        return;
+    }
+    LANE_LOOP {
+        SET(mask, reg[2*rp], v[l] >> 8);
+        SET(mask, reg[2*rp+1], v[l] & 0xff);
+    }
+}
+
+static void write(const uint8_t *mask, const uint16_t *a, const uint8_t *v) {
+    LANE_LOOP
+        if (mask[l])
+            mem[a[l]][l] = v[l];
+}
+
+static void push(const uint8_t *mask, const uint8_t *hi, const uint8_t *lo) {
+    LANE_LOOP
+        if (mask[l]) {
+            mem[(uint16_t) (sp[l] - 1)][l] = hi[l];
+            mem[(uint16_t) (sp[l] - 2)][l] = lo[l];
+            sp[l] -= 2;
+        }
+}
+
+static void pop(const uint8_t *mask, uint8_t *hi, uint8_t *lo) {
+    LANE_LOOP
+        if (mask[l]) {
+            lo[l] = mem[sp[l]][l];
+            hi[l] = mem[(uint16_t) (sp[l] + 1)][l];
+            sp[l] += 2;
+        }
+}
+
+// val = register s, or (HL)
+
+static void operand(int s) {
+    if (s == M)
+        LANE_LOOP val[l] = mem[hl(l)][l];
+    else
+        memcpy(val, reg[s], LANES);
+}
+
+static void output(int l, char c) {
+    if (out[l].len == out[l].size) {
+        out[l].size = out[l].size ? 2 * out[l].size : 4096;
+        out[l].buf = realloc(out[l].buf, out[l].size);
+        if (!out[l].buf) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    out[l].buf[out[l].len++] = c;
+}
+
+static void stop(int l, const char *why) {
+    char msg[64];
+
+    live[l] = 0;
+    if (!why)
+        return;
+    snprintf(msg, sizeof(msg), "\r\n%s at %04X\r\n", why, pc[l]);
+    for (char *p = msg; *p; p++)
+        output(l, *p);
+}
+
+// ADD ADC SUB SBB ANA XRA ORA CMP of A and val, like ADD() and so on in
+// atari8080.c
+
+static void alu(int op) {
+    switch (op) {
+    case 0:
+    case 1:
+        LANE_LOOP {
+            uint8_t a = reg[A][l], v = val[l], f = flags[l];
+            uint16_t z = a + v + (op & f & CF_FLAG);
+            uint8_t nf = (f & ~(ZSP_FLAGS | AF_FLAG | CF_FLAG))
+                       | ((z >> 8) & 1) | ((z ^ a ^ v) & AF_FLAG) | zsp(z);
+            SET(on, reg[A], z);
+            SET(on, flags, nf);
+        }
+        break;
+    case 2:
+    case 3:
+        LANE_LOOP {                     // A + ~val + !carry
+            uint8_t a = reg[A][l], f = flags[l];
+            uint16_t v = ~val[l] & 0x1ff;
+            uint16_t z = a + v + !(op & 1 & f);
+            uint8_t nf = (f & ~(ZSP_FLAGS | AF_FLAG | CF_FLAG))
+                       | (~(z ^ a ^ v) >> 8 & 1) | ((z ^ a ^ v) & AF_FLAG)
+                       | zsp(z);
+            SET(on, reg[A], z);
+            SET(on, flags, nf);
+        }
+        break;
+    case 4:
+        LANE_LOOP {
+            uint8_t a = reg[A][l], v = val[l], f = flags[l];
+            uint8_t nf = (f & ~(ZSP_FLAGS | AF_FLAG | CF_FLAG))
+                       | ((a | v) & 0x08 ? AF_FLAG : 0) | zsp(a & v);
+            SET(on, reg[A], a & v);
+            SET(on, flags, nf);
+        }
+        break;
+    case 5:
+        LANE_LOOP {
+            uint8_t r = reg[A][l] ^ val[l];
+            SET(on, reg[A], r);
+            SET(on, flags, ONE_FLAG | zsp(r));
+        }
+        break;
+    case 6:
+        LANE_LOOP {
+            uint8_t r = reg[A][l] | val[l];
+            SET(on, reg[A], r);
+            SET(on, flags, ONE_FLAG | zsp(r));
+        }
+        break;
+    case 7:
+        LANE_LOOP {
+            uint8_t a = reg[A][l], v = val[l], f = flags[l];
+            uint16_t z = a - v;
+            uint8_t nf = (f & ~(ZSP_FLAGS | AF_FLAG | CF_FLAG))
+                       | (z >> 8 ? CF_FLAG : 0) | (~(a ^ z ^ v) & AF_FLAG)
+                       | zsp(z);
+            SET(on, flags, nf);
+        }
+        break;
+    }
+}
+
+// go = on, and condition cc (NZ Z NC C PO PE P M) holds
+
+static void condition(int cc) {
+    static const uint8_t flag[4] = { ZF_FLAG, CF_FLAG, PF_FLAG, SF_FLAG };
+    uint8_t f = flag[cc >> 1], want = cc & 1;
+
+    LANE_LOOP go[l] = on[l] & ((!!(flags[l] & f)) == want);
+}
+
+static void jump(void) {
+    LANE_LOOP SET(go, pc, b3[l] << 8 | b2[l]);
+}
+
+static void call(void) {
+    uint8_t hi[LANES], lo[LANES];
+
+    LANE_LOOP {
+        hi[l] = pc[l] >> 8;
+        lo[l] = pc[l];
+    }
+    push(go, hi, lo);
+    jump();
+}
+
+static void ret(void) {
+    uint8_t hi[LANES], lo[LANES];
+
+    pop(go, hi, lo);
+    LANE_LOOP SET(go, pc, hi[l] << 8 | lo[l]);
+}
+
+static void bdos(int l) {
+    uint16_t de = reg[D][l] << 8 | reg[E][l];
+    uint8_t a = 0xff;
+
+    switch (reg[C][l]) {
+    case 0:
+        stop(l, NULL);
+        return;
+    case 1:                             // C_READ
+        a = 0x1a;
+        break;
+    case 2:                             // C_WRITE
+        output(l, reg[E][l]);
+        break;
+    case 6:                             // C_RAWIO
+        if (reg[E][l] >= 0xfe)
+            a = 0;
+        else
+            output(l, reg[E][l]);
+        break;
+    case 9:                             // C_WRITESTR
+        for (int i=0; i<65536 && mem[de][l] != '$'; i++, de++)
+            output(l, mem[de][l]);
+        break;
+    case 10:                            // C_READSTR
+        mem[(uint16_t) (de+1)][l] = 0;
+        break;
+    case 11:                            // C_STAT
+        a = 0;
+        break;
+    case 12:                            // S_BDOSVER
+        a = 0x22;
+        break;
+    }
+    reg[A][l] = reg[L][l] = a;
+    reg[B][l] = reg[H][l] = 0;
+    pc[l] = mem[sp[l]][l] | mem[(uint16_t) (sp[l] + 1)][l] << 8;
+    sp[l] += 2;
+}
+
+static void execute(int op) {
+    int d = (op >> 3) & 7, s = op & 7, rp = (op >> 4) & 3;
+    uint16_t w[LANES];
+    uint8_t t[LANES];
+
+    switch (op) {
+    case 0x00: case 0xf3: case 0xfb:    // NOP DI EI
+        break;
+
+    case 0x76:                          // HLT
+        LANE_LOOP if (on[l]) stop(l, "HLT");
+        break;
+
+    case 0x40 ... 0x75:
+    case 0x77 ... 0x7f:                 // MOV d,s
+        operand(s);
+        if (d == M) {
+            LANE_LOOP w[l] = hl(l);
+            write(on, w, val);
+        } else
+            LANE_LOOP SET(on, reg[d], val[l]);
+        break;
+
+    case 0x80 ... 0xbf:
+        operand(s);
+        alu(d);
+        break;
+
+    case 0xc6: case 0xce: case 0xd6: case 0xde:
+    case 0xe6: case 0xee: case 0xf6: case 0xfe:
+        memcpy(val, b2, LANES);
+        alu(d);
+        break;
+
+    case 0x06: case 0x0e: case 0x16: case 0x1e:
+    case 0x26: case 0x2e: case 0x36: case 0x3e:     // MVI
+        if (d == M) {
+            LANE_LOOP w[l] = hl(l);
+            write(on, w, b2);
+        } else
+            LANE_LOOP SET(on, reg[d], b2[l]);
+        break;
+
+    case 0x04: case 0x0c: case 0x14: case 0x1c:
+    case 0x24: case 0x2c: case 0x34: case 0x3c:     // INR
+    case 0x05: case 0x0d: case 0x15: case 0x1d:
+    case 0x25: case 0x2d: case 0x35: case 0x3d:     // DCR
+        operand(d);
+        LANE_LOOP {
+            uint8_t r = val[l] + (s == 4 ? 1 : -1);
+            uint8_t af = s == 4 ? (r & 0x0f) == 0 : (r & 0x0f) != 0x0f;
+            uint8_t nf = (flags[l] & ~(ZSP_FLAGS | AF_FLAG))
+                       | (af ? AF_FLAG : 0) | zsp(r);
+            val[l] = r;
+            SET(on, flags, nf);
+        }
+        if (d == M) {
+            LANE_LOOP w[l] = hl(l);
+            write(on, w, val);
+        } else
+            LANE_LOOP SET(on, reg[d], val[l]);
+        break;
+
+    case 0x01: case 0x11: case 0x21: case 0x31:     // LXI
+        LANE_LOOP w[l] = b3[l] << 8 | b2[l];
+        set_pair(rp, on, w);
+        break;
+    case 0x03: case 0x13: case 0x23: case 0x33:     // INX
+        LANE_LOOP w[l] = pair(rp, l) + 1;
+        set_pair(rp, on, w);
+        break;
+    case 0x0b: case 0x1b: case 0x2b: case 0x3b:     // DCX
+        LANE_LOOP w[l] = pair(rp, l) - 1;
+        set_pair(rp, on, w);
+        break;
+    case 0x09: case 0x19: case 0x29: case 0x39:     // DAD
+        LANE_LOOP {
+            uint32_t r = hl(l) + pair(rp, l);
+            w[l] = r;
+            SET(on, flags, (flags[l] & ~CF_FLAG) | (r >> 16));
+        }
+        set_pair(2, on, w);
+        break;
+
+    case 0x02: case 0x12:                           // STAX
+        LANE_LOOP w[l] = pair(rp, l);
+        write(on, w, reg[A]);
+        break;
+    case 0x0a: case 0x1a:                           // LDAX
+        LANE_LOOP SET(on, reg[A], mem[pair(rp, l)][l]);
+        break;
+    case 0x22:                                      // SHLD
+        LANE_LOOP w[l] = b3[l] << 8 | b2[l];
+        write(on, w, reg[L]);
+        LANE_LOOP w[l]++;
+        write(on, w, reg[H]);
+        break;
+    case 0x2a:                                      // LHLD
+        LANE_LOOP {
+            uint16_t a = b3[l] << 8 | b2[l];
+            SET(on, reg[L], mem[a][l]);
+            SET(on, reg[H], mem[(uint16_t) (a+1)][l]);
+        }
+        break;
+    case 0x32:                                      // STA
+        LANE_LOOP w[l] = b3[l] << 8 | b2[l];
+        write(on, w, reg[A]);
+        break;
+    case 0x3a:                                      // LDA
+        LANE_LOOP SET(on, reg[A], mem[b3[l] << 8 | b2[l]][l]);
+        break;
+
+    case 0x07:                                      // RLC
+        LANE_LOOP {
+            uint8_t a = reg[A][l], c = a >> 7;
+            SET(on, reg[A], a << 1 | c);
+            SET(on, flags, (flags[l] & ~CF_FLAG) | c);
+        }
+        break;
+    case 0x0f:                                      // RRC
+        LANE_LOOP {
+            uint8_t a = reg[A][l], c = a & 1;
+            SET(on, reg[A], a >> 1 | c << 7);
+            SET(on, flags, (flags[l] & ~CF_FLAG) | c);
+        }
+        break;
+    case 0x17:                                      // RAL
+        LANE_LOOP {
+            uint8_t a = reg[A][l];
+            SET(on, reg[A], a << 1 | (flags[l] & CF_FLAG));
+            SET(on, flags, (flags[l] & ~CF_FLAG) | a >> 7);
+        }
+        break;
+    case 0x1f:                                      // RAR
+        LANE_LOOP {
+            uint8_t a = reg[A][l];
+            SET(on, reg[A], a >> 1 | (flags[l] & CF_FLAG) << 7);
+            SET(on, flags, (flags[l] & ~CF_FLAG) | (a & 1));
+        }
+        break;
+    case 0x27:                                      // DAA
+        LANE_LOOP {
+            uint8_t a = reg[A][l], cy = flags[l] & CF_FLAG;
+            val[l] = 0;
+            if (daa_table_cond1[a] || (flags[l] & AF_FLAG))
+                val[l] += 0x06;
+            if (daa_table_cond2[a] || cy) {
+                val[l] += 0x60;
+                cy = CF_FLAG;
+            }
+            t[l] = cy;
+        }
+        alu(0);
+        LANE_LOOP SET(on, flags, (flags[l] & ~CF_FLAG) | t[l]);
+        break;
+    case 0x2f:                                      // CMA
+        LANE_LOOP SET(on, reg[A], ~reg[A][l]);
+        break;
+    case 0x37:                                      // STC
+        LANE_LOOP SET(on, flags, flags[l] | CF_FLAG);
+        break;
+    case 0x3f:                                      // CMC
+        LANE_LOOP SET(on, flags, flags[l] ^ CF_FLAG);
+        break;
+
+    case 0xc1: case 0xd1: case 0xe1:                // POP
+        pop(on, reg[2*rp], reg[2*rp+1]);
+        break;
+    case 0xf1:                                      // POP PSW
+        pop(on, reg[A], t);
+        LANE_LOOP SET(on, flags, (t[l] | ONE_FLAG) & ALL_FLAGS);
+        break;
+    case 0xc5: case 0xd5: case 0xe5:                // PUSH
+        push(on, reg[2*rp], reg[2*rp+1]);
+        break;
+    case 0xf5:                                      // PUSH PSW
+        push(on, reg[A], flags);
+        break;
+
+    case 0xc0: case 0xc8: case 0xd0: case 0xd8:
+    case 0xe0: case 0xe8: case 0xf0: case 0xf8:     // Rcc
+        condition(d);
+        ret();
+        break;
+    case 0xc9:                                      // RET
+        memcpy(go, on, LANES);
+        ret();
+        break;
+    case 0xc2: case 0xca: case 0xd2: case 0xda:
+    case 0xe2: case 0xea: case 0xf2: case 0xfa:     // Jcc
+        condition(d);
+        jump();
+        break;
+    case 0xc3:                                      // JMP
+        memcpy(go, on, LANES);
+        jump();
+        break;
+    case 0xc4: case 0xcc: case 0xd4: case 0xdc:
+    case 0xe4: case 0xec: case 0xf4: case 0xfc:     // Ccc
+        condition(d);
+        call();
+        break;
+    case 0xcd:                                      // CALL
+        memcpy(go, on, LANES);
+        call();
+        break;
+    case 0xc7: case 0xcf: case 0xd7: case 0xdf:
+    case 0xe7: case 0xef: case 0xf7: case 0xff:     // RST
+        memset(b2, op & 0x38, LANES);
+        memset(b3, 0, LANES);
+        memcpy(go, on, LANES);
+        call();
+        break;
+
+    case 0xe3:                                      // XTHL
+        LANE_LOOP {
+            uint16_t s0 = sp[l], s1 = sp[l] + 1;
+            uint8_t lo = mem[s0][l], hi = mem[s1][l];
+            if (on[l]) {
+                mem[s0][l] = reg[L][l];
+                mem[s1][l] = reg[H][l];
+            }
+            SET(on, reg[L], lo);
+            SET(on, reg[H], hi);
+        }
+        break;
+    case 0xeb:                                      // XCHG
+        LANE_LOOP {
+            uint8_t h = reg[H][l], lo = reg[L][l];
+            SET(on, reg[H], reg[D][l]);
+            SET(on, reg[L], reg[E][l]);
+            SET(on, reg[D], h);
+            SET(on, reg[E], lo);
+        }
+        break;
+    case 0xe9:                                      // PCHL
+        LANE_LOOP SET(on, pc, hl(l));
+        break;
+    case 0xf9:                                      // SPHL
+        LANE_LOOP SET(on, sp, hl(l));
+        break;
+
+    case 0xd3:
+        LANE_LOOP if (on[l]) stop(l, "OUT");
+        break;
+    case 0xdb:
+        LANE_LOOP if (on[l]) stop(l, "IN");
+        break;
+    default:
+        LANE_LOOP if (on[l]) stop(l, "undefined opcode");
+        break;
+    }
+}
+
+// Runs the lanes at the lowest PC that have the opcode of the first of them
+
+static void step(void) {
+    uint16_t p = 0xffff;
+    int lead = -1, n = 0;
+
+    LANE_LOOP {
+        uint16_t q = live[l] ? pc[l] : 0xffff;
+        p = q < p ? q : p;
+    }
+    for (int l=0; l<LANES; l++)
+        if (live[l] && pc[l] == p) {
+            lead = l;
+            break;
+        }
+    if (lead < 0)
+        return;
+
+    if (p == 0x0000 || p == BDOS_ENTRY) {
+        LANE_LOOP
+            if (live[l] && pc[l] == p) {
+                if (p)
+                    bdos(l);
+                else
+                    stop(l, NULL);      // warm boot
+            }
+        return;
+    }
+
+    uint8_t op = mem[p][lead];
+    LANE_LOOP {
+        on[l] = live[l] & (pc[l] == p) & (mem[p][l] == op);
+        b2[l] = mem[(uint16_t) (p+1)][l];
+        b3[l] = mem[(uint16_t) (p+2)][l];
+        n += on[l];
+    }
+    steps++;
+    executed += n;
+    LANE_LOOP SET(on, pc, (uint16_t) (p + instruction_length[op]));
+    execute(op);
+}
+
+// Loads the program with a command tail and FCBs, like the CCP
+
+static void load(int l, const uint8_t *com, int len, const char *tail) {
+    char fcb[2][11];
+    const char *p = tail;
+
+    for (int a=0; a<65536; a++)
+        mem[a][l] = 0;
+    for (int i=0; i<len; i++)
+        mem[0x0100+i][l] = com[i];
+    mem[0x0005][l] = 0xc3;              // JMP BDOS_ENTRY
+    mem[0x0006][l] = BDOS_ENTRY & 0xff;
+    mem[0x0007][l] = BDOS_ENTRY >> 8;
+
+    memset(fcb, ' ', sizeof(fcb));
+    for (int f=0; f<2; f++) {
+        int i = 0;
+        while (*p == ' ')
+            p++;
+        for (; *p && *p != ' '; p++)
+            if (*p == '.')
+                i = 8;
+            else if (i < 11)
+                fcb[f][i++] = toupper((unsigned char) *p);
+    }
+    for (int f=0; f<2; f++)
+        for (int i=0; i<11; i++)
+            mem[0x005d + 16*f + i][l] = fcb[f][i];
+
+    int n = strlen(tail);
+    if (n > 126)
+        n = 126;
+    mem[0x0080][l] = n ? n + 1 : 0;
+    if (n)
+        mem[0x0081][l] = ' ';
+    for (int i=0; i<n; i++)
+        mem[0x0082+i][l] = toupper((unsigned char) tail[i]);
+
+    for (int r=0; r<8; r++)
+        reg[r][l] = 0;
+    flags[l] = ONE_FLAG;
+    pc[l] = 0x0100;
+    sp[l] = BDOS_ENTRY - 2;             // returns to 0000H
+    live[l] = 1;
+    out[l].len = 0;
+}
+
+int main(int argc, char **argv) {
+    const char *name = NULL, *tails = NULL;
+    char **tail = NULL, line[256];
+    int n = 1;
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-n") && i+1 < argc)
+            n = atoi(argv[++i]);
+        else if (!name)
+            name = argv[i];
+        else if (!tails)
+            tails = argv[i];
+        else
+            name = NULL;
+    }
+    if (!name || n < 1) {
+        fprintf(stderr, "usage: atari8080-lanes [-n machines] PROGRAM.COM "
+                        "[tails]\n");
+        return 1;
+    }
+
+    static uint8_t com[0xfe00 - 0x0100];
+    FILE *f = fopen(name, "rb");
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", name);
+        return 1;
+    }
+    int len = fread(com, 1, sizeof(com), f);
+    fclose(f);
+
+    if (tails) {
+        f = fopen(tails, "r");
+        if (!f) {
+            fprintf(stderr, "unable to open %s\n", tails);
+            return 1;
+        }
+        for (n=0; fgets(line, sizeof(line), f); n++) {
+            line[strcspn(line, "\r\n")] = 0;
+            tail = realloc(tail, (n + 1) * sizeof(*tail));
+            tail[n] = strdup(line);
+        }
+        fclose(f);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (int first=0; first<n; first+=LANES) {
+        memset(live, 0, sizeof(live));
+        for (int l=0; l<LANES && first+l<n; l++)
+            load(l, com, len, tail ? tail[first+l] : "");
+        while (memchr(live, 1, LANES))
+            step();
+        for (int l=0; l<LANES && first+l<n; l++) {
+            if (n > 1)
+                printf("--- machine %d\n", first + l);
+            fwrite(out[l].buf, 1, out[l].len, stdout);
+            if (n > 1 && out[l].len && out[l].buf[out[l].len-1] != '\n')
+                putchar('\n');
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "lanes8080: %d machines, %llu instructions in %llu steps, "
+                    "%.1f lanes per step, %.2f s, %.1f MIPS\n", n,
+                    (unsigned long long) executed, (unsigned long long) steps,
+                    steps ? (double) executed / steps : 0, s,
+                    executed / s / 1e6);
+    return 0;
+}
@@ -0,0 +1,49 @@
+// Interface between lockstep8080.c and the two machines it runs, which are
+// both atari8080.c, compiled with -DLOCKSTEP=ref and -DLOCKSTEP=cand.
+
+#define LOCKSTEP_INSN       0       // stop after every instruction
+#define LOCKSTEP_BLOCK      1       // after jumps, calls, returns and traps
+#define LOCKSTEP_TRAP       2       // after BIOS and BDOS traps
+
+#define LOCKSTEP_HISTORY    256     // instructions kept, a power of two
+
+enum {                              // why a machine stopped for good
+    LOCKSTEP_RUNNING = 0,
+    LOCKSTEP_HLT,
+    LOCKSTEP_UNDEFINED,             // undefined opcode
+    LOCKSTEP_IO,                    // IN or OUT while fuzzing
+};
+
+struct lockstep_insn {
+    uint64_t count;
+    uint16_t pc;
+    uint8_t op, byte2, byte3;
+};
+
+struct lockstep_state {
+    uint64_t icount;
+    int status;
+    uint16_t pc, sp;
+    uint8_t a, f, b, c, d, e, h, l;
+    uint8_t (*mem)[16384];
+    uint8_t *dirty;                 // pages written since the last compare
+    const struct lockstep_insn *history;
+};
+
+// The candidate does the console input and records it, the reference
+// replays it.
+
+int lockstep_record(int value);
+int lockstep_replay(void);
+
+#define LOCKSTEP_API(prefix) \
+    int prefix##_init(int reference, int mode, const char *disk1, \
+                                               const char *disk2); \
+    int prefix##_run(void); \
+    void prefix##_state(struct lockstep_state *s); \
+    void prefix##_load(const struct lockstep_state *s, const uint8_t *code, \
+                                                       int len); \
+    void prefix##_limit(uint64_t icount);
+
+LOCKSTEP_API(ref)
+LOCKSTEP_API(cand)
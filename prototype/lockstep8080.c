@@ -0,0 +1,282 @@
+// -------------------------------------------------------------------------
+//
+// lockstep8080 - run a candidate engine in lockstep with the reference
+//
+// usage: atari8080-lockstep-ENGINE [-g insn|block|trap] [-n count]
+//                                  disk.img disk2.img
+//
+// Both machines are atari8080.c, linked into the same program twice, see
+// lockstep.h and the Makefile. The reference is the plain switch core, the
+// candidate is built like atari8080-superops or atari8080-aot (without the
+// translation cache). The candidate is the live machine: it uses the disk
+// images and the console like atari8080 does. The reference runs on copies
+// of the images, prints nothing, and gets the same console input.
+//
+// The candidate runs until its next stop, after every instruction, after
+// every jump, call, return and trap (block, the default) or only after BIOS
+// and BDOS traps. The reference is then single stepped up to the same
+// number of instructions, and the PC, SP, registers, flags and every page
+// of memory that either of them wrote since the last compare must be the
+// same. Native code of atari8080-aot counts its instructions, but only
+// stops when it returns to the interpreter.
+//
+// At the first difference, it prints the last count (16) instructions the
+// reference executed and what differs, and exits with 1.
+//
+// -------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "tables/tables.h"
+#include "lockstep.h"
+
+static struct termios orig_termios;
+static int raw_terminal;
+static uint64_t executed, compares;
+static int diverged;
+
+static const char *stopped[] = { "running", "HLT", "undefined opcode",
+                                 "IN/OUT" };
+
+// console input of the candidate, waiting for the reference
+
+static int input[4096];
+static unsigned input_head, input_tail;
+static int input_missing;
+
+int lockstep_record(int value) {
+    input[input_head++ % 4096] = value;
+    return value;
+}
+
+int lockstep_replay(void) {
+    if (input_tail == input_head) {
+        input_missing = 1;
+        return 0;
+    }
+    return input[input_tail++ % 4096];
+}
+
+// -------------------------------------------------------------------------
+
+static void reset_terminal_mode(void) {
+    if (raw_terminal)
+        tcsetattr(0, TCSANOW, &orig_termios);
+}
+
+static void summary(void) {
+    if (!diverged)
+        fprintf(stderr, "lockstep: %llu instructions, %llu compares, "
+                        "no differences\n",
+                        (unsigned long long) executed,
+                        (unsigned long long) compares);
+}
+
+static void print_insn(const struct lockstep_insn *h) {
+    const char *m = mnemonics[h->op];
+    const char *sep = m[strlen(m)-1] == ',' ? "" : " ";
+
+    fprintf(stderr, "%12llu  %04X  %02X  %s", (unsigned long long) h->count,
+                                              h->pc, h->op, m);
+    if (modes[h->op] == MODE_D8)
+        fprintf(stderr, "%s%02XH", sep, h->byte2);
+    else if (instruction_length[h->op] == 3)
+        fprintf(stderr, "%s%02X%02XH", sep, h->byte3, h->byte2);
+    fprintf(stderr, "\n");
+}
+
+static void print_reg(const char *name, int width, int r, int c) {
+    fprintf(stderr, "  %-4s  %4.*X  %4.*X%s\n", name, width, r, width, c,
+                                                r != c ? "   <--" : "");
+}
+
+static void report(const char *why, struct lockstep_state *r,
+                   struct lockstep_state *c, int history) {
+    diverged = 1;
+    reset_terminal_mode();
+
+    fprintf(stderr, "\nlockstep: %s, after %llu instructions\n\n", why,
+                                        (unsigned long long) r->icount);
+
+    fprintf(stderr, "last instructions of the reference:\n");
+    uint64_t first = r->icount > history ? r->icount - history + 1 : 1;
+    for (uint64_t i = first; i <= r->icount; i++) {
+        const struct lockstep_insn *h = &r->history[i & (LOCKSTEP_HISTORY-1)];
+        if (h->count == i)
+            print_insn(h);
+    }
+
+    fprintf(stderr, "\n         ref  cand\n");
+    print_reg("PC", 4, r->pc, c->pc);
+    print_reg("SP", 4, r->sp, c->sp);
+    print_reg("A", 2, r->a, c->a);
+    print_reg("F", 2, r->f, c->f);
+    print_reg("B", 2, r->b, c->b);
+    print_reg("C", 2, r->c, c->c);
+    print_reg("D", 2, r->d, c->d);
+    print_reg("E", 2, r->e, c->e);
+    print_reg("H", 2, r->h, c->h);
+    print_reg("L", 2, r->l, c->l);
+    if (r->status || c->status)
+        fprintf(stderr, "  stopped by %s and %s\n", stopped[r->status],
+                                                     stopped[c->status]);
+
+    int shown = 0;
+    for (int adr=0; adr<65536 && shown<16; adr++) {
+        uint8_t x = r->mem[adr>>14][adr&0x3fff];
+        uint8_t y = c->mem[adr>>14][adr&0x3fff];
+        if ((r->dirty[adr>>8] || c->dirty[adr>>8]) && x != y) {
+            if (!shown++)
+                fprintf(stderr, "\n         ref  cand\n");
+            fprintf(stderr, "  %04X    %02X    %02X\n", adr, x, y);
+        }
+    }
+    exit(1);
+}
+
+// Compares registers and the pages written since the last clean().
+
+static const char *compare(struct lockstep_state *r, struct lockstep_state *c) {
+    compares++;
+
+    if (r->pc != c->pc || r->sp != c->sp || r->f != c->f
+            || r->a != c->a || r->b != c->b || r->c != c->c || r->d != c->d
+            || r->e != c->e || r->h != c->h || r->l != c->l)
+        return "registers differ";
+
+    uint64_t *rd = (uint64_t *) r->dirty, *cd = (uint64_t *) c->dirty;
+
+    for (int p=0; p<256; p++) {
+        if (!(p & 7) && !rd[p/8] && !cd[p/8]) {
+            p += 7;
+            continue;
+        }
+        if (!r->dirty[p] && !c->dirty[p])
+            continue;
+        if (memcmp(&r->mem[p>>6][(p&0x3f)<<8], &c->mem[p>>6][(p&0x3f)<<8],
+                                                                    256))
+            return "memory differs";
+    }
+    return NULL;
+}
+
+static void clean(struct lockstep_state *r, struct lockstep_state *c) {
+    memset(r->dirty, 0, 256);
+    memset(c->dirty, 0, 256);
+}
+
+// The reference runs on a copy of the disk image, which is removed again
+// as soon as it is open.
+
+static int copy_image(const char *from, char *to) {
+    char buf[65536];
+    size_t n;
+
+    FILE *in = fopen(from, "rb");
+    if (!in) {
+        fprintf(stderr, "unable to open %s\n", from);
+        return -1;
+    }
+    strcpy(to, "/tmp/lockstep-XXXXXX");
+    int fd = mkstemp(to);
+    FILE *out = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!out) {
+        fprintf(stderr, "unable to create %s\n", to);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+    return 0;
+}
+
+#ifndef FUZZ
+
+int main(int argc, char **argv) {
+    int mode = LOCKSTEP_BLOCK, history = 16;
+    const char *disk[2];
+    char copy[2][32];
+    int i, ndisks = 0;
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-g") && i+1<argc) {
+            i++;
+            if (!strcmp(argv[i], "insn")) mode = LOCKSTEP_INSN;
+            else if (!strcmp(argv[i], "block")) mode = LOCKSTEP_BLOCK;
+            else if (!strcmp(argv[i], "trap")) mode = LOCKSTEP_TRAP;
+            else ndisks = 3;
+        } else if (!strcmp(argv[i], "-n") && i+1<argc) {
+            history = atoi(argv[++i]);
+            if (history > LOCKSTEP_HISTORY)
+                history = LOCKSTEP_HISTORY;
+        } else if (ndisks < 2) {
+            disk[ndisks++] = argv[i];
+        } else {
+            ndisks = 3;
+        }
+    }
+    if (ndisks != 2) {
+        fprintf(stderr, "usage: %s [-g insn|block|trap] [-n count] "
+                        "disk.img disk2.img\n", argv[0]);
+        return 1;
+    }
+
+    for (i=0; i<2; i++)
+        if (copy_image(disk[i], copy[i]) < 0)
+            return 1;
+    int err = ref_init(1, LOCKSTEP_INSN, copy[0], copy[1]);
+    remove(copy[0]);
+    remove(copy[1]);
+    if (err < 0 || cand_init(0, mode, disk[0], disk[1]) < 0)
+        return 1;
+
+    struct termios new_termios;
+
+    tcgetattr(0, &orig_termios);
+    memcpy(&new_termios, &orig_termios, sizeof(new_termios));
+    atexit(summary);
+    atexit(reset_terminal_mode);
+    cfmakeraw(&new_termios);
+    tcsetattr(0, TCSANOW, &new_termios);
+    raw_terminal = 1;
+
+    struct lockstep_state r, c;
+    int ref_halted = 0, cand_halted = 0;
+
+    ref_state(&r);
+    while (!cand_halted) {
+        cand_halted = cand_run();
+        cand_state(&c);
+
+        while (r.icount < c.icount && !ref_halted && !input_missing) {
+            ref_halted = ref_run();
+            ref_state(&r);
+        }
+
+        if (input_missing)
+            report("the reference reads input the candidate did not",
+                                                        &r, &c, history);
+        if (r.icount != c.icount || ref_halted != cand_halted)
+            report(ref_halted ? "the reference stopped"
+                              : "instruction counts differ", &r, &c, history);
+
+        const char *why = compare(&r, &c);
+        if (why)
+            report(why, &r, &c, history);
+        clean(&r, &c);
+        executed = c.icount;
+    }
+    reset_terminal_mode();
+    if (cand_halted != LOCKSTEP_HLT)
+        fprintf(stderr, "lockstep: stopped by %s\n", stopped[cand_halted]);
+
+    return 0;
+}
+
+#endif
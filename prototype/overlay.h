@@ -0,0 +1,20 @@
+// Disk overlays, a read-only base image and a delta with the sectors that
+// were written, used by atari8080.c and overlay8080.c.
+//
+// The delta is the header, followed by records of a sector number and its
+// 128 bytes, in the order the sectors were first written. A sector that is
+// written again is overwritten in place, so every sector is in it once.
+// The index of sectors to records is built when the delta is opened. A
+// record that was cut short at the end is ignored.
+
+#define OVERLAY_MAGIC       "atari8080 delta"
+
+struct overlay_header {
+    char magic[16];                 // OVERLAY_MAGIC
+    uint64_t base_size;             // of the base image, in bytes
+};
+
+struct overlay_record {
+    uint32_t sector;
+    uint8_t data[128];
+};
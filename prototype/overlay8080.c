@@ -0,0 +1,99 @@
+// -------------------------------------------------------------------------
+//
+// overlay8080 - show or merge the delta of a disk overlay
+//
+// usage: overlay8080 info delta
+//        overlay8080 merge base.img delta
+//
+// A drive named base.img+delta runs on the read-only base image, and
+// writes to the delta, see overlay.h. info lists the sectors in the delta,
+// merge writes them to the base image and removes the delta. To discard a
+// delta, remove it.
+//
+// -------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "overlay.h"
+
+static FILE *open_delta(const char *name, struct overlay_header *h) {
+    FILE *f = fopen(name, "rb");
+
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", name);
+        return NULL;
+    }
+    if (fread(h, sizeof(*h), 1, f) != 1 || strcmp(h->magic, OVERLAY_MAGIC)) {
+        fprintf(stderr, "%s is not a delta\n", name);
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+static int info(const char *name) {
+    struct overlay_header h;
+    struct overlay_record r;
+    unsigned n = 0;
+
+    FILE *f = open_delta(name, &h);
+    if (!f)
+        return 1;
+    printf("base image of %llu bytes\n", (unsigned long long) h.base_size);
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        printf("%s%u", n % 10 ? " " : n ? "\n" : "", r.sector);
+        n++;
+    }
+    printf("%s%u sectors\n", n ? "\n" : "", n);
+    fclose(f);
+    return 0;
+}
+
+static int merge(const char *base, const char *name) {
+    struct overlay_header h;
+    struct overlay_record r;
+    unsigned n = 0;
+
+    FILE *f = open_delta(name, &h);
+    if (!f)
+        return 1;
+    FILE *b = fopen(base, "rb+");
+    if (!b) {
+        fprintf(stderr, "unable to open %s\n", base);
+        return 1;
+    }
+    fseek(b, 0, SEEK_END);
+    if (ftell(b) != h.base_size) {
+        fprintf(stderr, "%s belongs to another base image\n", name);
+        return 1;
+    }
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        fseek(b, r.sector * 128L, SEEK_SET);
+        if (fwrite(r.data, 1, 128, b) != 128) {
+            fprintf(stderr, "unable to write %s\n", base);
+            return 1;
+        }
+        n++;
+    }
+    fclose(f);
+    if (fclose(b)) {
+        fprintf(stderr, "unable to write %s\n", base);
+        return 1;
+    }
+    remove(name);                   // it would no longer match the base
+    printf("%u sectors merged into %s\n", n, base);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "info"))
+        return info(argv[2]);
+    if (argc == 4 && !strcmp(argv[1], "merge"))
+        return merge(argv[2], argv[3]);
+
+    fprintf(stderr, "usage: overlay8080 info delta\n"
+                    "       overlay8080 merge base.img delta\n");
+    return 1;
+}
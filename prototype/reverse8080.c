@@ -0,0 +1,499 @@
+// -------------------------------------------------------------------------
+//
+// reverse8080 - reverse execution for debugging long runs
+//
+// usage: atari8080-reverse [-i interval] [-k count] [-s icount] [-b]
+//                          disk.img disk2.img
+//
+// Built from atari8080.c with the plain switch core, see the Makefile. It
+// runs like atari8080, and takes a checkpoint every interval (1000000)
+// instructions: the registers, the state of the BIOS disk calls, the pages
+// written since the previous checkpoint, and how many console inputs were
+// read. The first checkpoint holds all of memory. When there are count
+// (4096) checkpoints, the oldest two are merged. Every BIOS disk write
+// first saves the old contents of the sector.
+//
+// To go back, the nearest checkpoint before is restored, the sectors that
+// were written since are put back, and the machine runs forward to the
+// instruction wanted. It reads the same console input as the first time,
+// so it does the same, but prints nothing until it gets further than it
+// got before.
+//
+// It stops and asks for commands at instruction icount (-s), at HLT or an
+// undefined opcode, when a program writes to the BDOS area (-b), and at the
+// next checkpoint after ^\. Commands are read from standard input:
+//
+//   c           continue
+//   s [n]       step n instructions forward (1)
+//   b [n]       step n instructions back (1)
+//   g n         go to instruction n, back or forward
+//   w adr       go back to the last write to adr
+//   r           show the registers
+//   m adr [n]   show n bytes of memory (64)
+//   q           quit
+//
+// Counts are decimal, addresses hexadecimal. A recorded session can be
+// replayed with ATARI8080_REPLAY and debugged without a terminal.
+//
+// -------------------------------------------------------------------------
+
+#define REVERSE
+#include "atari8080.c"
+
+#include <signal.h>
+#include <unistd.h>
+
+struct checkpoint {
+    uint64_t icount;
+    struct zp zp;
+    uint8_t F, curbank;
+    uint16_t dma_address, drive_number, track_number, sector_number;
+    size_t cursor, entry, offset;   // console input, see below
+    uint8_t dirty[256];
+    uint8_t *pages;                 // the dirty ones, in order
+};
+
+static struct checkpoint *cps;
+static int ncps, max_cps = 4096;
+static uint64_t interval = 1000000;
+static int checkpointing = 1;
+
+static volatile sig_atomic_t interrupted;
+static struct termios raw_termios;
+static int terminal;
+
+// Console input, runs of the same value are one entry. reverse_cursor
+// counts the inputs read so far, entry and offset say where that is: the
+// first offset inputs of the run of entry have been read. A run can grow
+// after a checkpoint, so the end of a run is not the start of the next.
+
+static struct input {
+    uint64_t icount;                // of the first of the run
+    int value;
+    uint64_t repeat;
+} *inputs;
+static size_t ninputs, inputs_size, entry, offset;
+
+static int reverse_record(int value) {
+    if (ninputs && inputs[ninputs-1].value == value) {
+        inputs[ninputs-1].repeat++;
+    } else {
+        if (ninputs == inputs_size) {
+            inputs_size = inputs_size ? 2 * inputs_size : 4096;
+            inputs = realloc(inputs, inputs_size * sizeof(*inputs));
+            if (!inputs) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        inputs[ninputs++] = (struct input) { icount, value, 1 };
+    }
+    reverse_cursor = ++reverse_ninputs;
+    entry = ninputs - 1;
+    offset = inputs[entry].repeat;
+    return value;
+}
+
+static int reverse_replay(void) {
+    if (offset == inputs[entry].repeat) {
+        entry++;
+        offset = 0;
+    }
+
+    struct input *in = &inputs[entry];
+
+    if (!offset && in->icount != icount)
+        fprintf(stderr, "reverse: input of instruction %llu read at %llu\n",
+                (unsigned long long) in->icount, (unsigned long long) icount);
+    reverse_cursor++;
+    offset++;
+    return in->value;
+}
+
+// Old contents of the sectors written by the BIOS
+
+static struct undo {
+    uint64_t icount;
+    int drive;
+    long sector;
+    uint8_t data[128];
+} *undo;
+static size_t nundo, undo_size;
+
+// Called before the sector is written
+
+static void reverse_disk_write(int drive, long sector) {
+    if (nundo == undo_size) {
+        undo_size = undo_size ? 2 * undo_size : 1024;
+        undo = realloc(undo, undo_size * sizeof(*undo));
+        if (!undo) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    struct undo *u = &undo[nundo++];
+    u->icount = icount;
+    u->drive = drive;
+    u->sector = sector;
+    memset(u->data, 0, 128);        // beyond the end of the image
+    disk_read(drive, sector, u->data);
+}
+
+// -------------------------------------------------------------------------
+
+static uint8_t *page(int p) {
+    return &mem[p>>6][(p&0x3f)<<8];
+}
+
+static uint8_t *saved_page(struct checkpoint *cp, int p) {
+    int slot = 0;
+
+    if (!cp->dirty[p])
+        return NULL;
+    for (int i=0; i<p; i++)
+        slot += cp->dirty[i];
+    return cp->pages + slot * 256;
+}
+
+static void take_checkpoint(void) {
+    if (ncps == max_cps) {          // merge the second into the first
+        for (int p=0; p<256; p++)
+            if (cps[1].dirty[p])
+                memcpy(saved_page(&cps[0], p), saved_page(&cps[1], p), 256);
+        free(cps[1].pages);
+        uint8_t *pages = cps[0].pages;
+        cps[0] = cps[1];
+        cps[0].pages = pages;
+        memset(cps[0].dirty, 1, 256);
+        memmove(&cps[1], &cps[2], (ncps - 2) * sizeof(*cps));
+        ncps--;
+
+        size_t n = 0;               // and forget older sectors
+        while (n < nundo && undo[n].icount <= cps[0].icount)
+            n++;
+        memmove(undo, undo + n, (nundo - n) * sizeof(*undo));
+        nundo -= n;
+    }
+
+    struct checkpoint *cp = &cps[ncps++];
+    int n = 0;
+
+    for (int p=0; p<256; p++)
+        n += reverse_dirty[p];
+    cp->pages = malloc(n * 256 + 1);
+    if (!cp->pages) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(cp->dirty, reverse_dirty, 256);
+    for (int p=0, slot=0; p<256; p++)
+        if (reverse_dirty[p])
+            memcpy(cp->pages + 256 * slot++, page(p), 256);
+    memset(reverse_dirty, 0, 256);
+
+    cp->icount = icount;
+    cp->zp = zp;
+    cp->F = F;
+    cp->curbank = curbank;
+    cp->dma_address = dma_address;
+    cp->drive_number = drive_number;
+    cp->track_number = track_number;
+    cp->sector_number = sector_number;
+    cp->cursor = reverse_cursor;
+    cp->entry = entry;
+    cp->offset = offset;
+}
+
+// Back to checkpoint k, the later ones are dropped.
+
+static void restore(int k) {
+    struct checkpoint *cp = &cps[k];
+    uint8_t changed[256];
+
+    if (icount > reverse_frontier)
+        reverse_frontier = icount;
+
+    memcpy(changed, reverse_dirty, 256);
+    for (int j=k+1; j<ncps; j++) {
+        for (int p=0; p<256; p++)
+            changed[p] |= cps[j].dirty[p];
+        free(cps[j].pages);
+    }
+    for (int p=0; p<256; p++) {
+        if (!changed[p])
+            continue;
+        for (int j=k; j>=0; j--) {
+            uint8_t *saved = saved_page(&cps[j], p);
+            if (saved) {
+                memcpy(page(p), saved, 256);
+                break;
+            }
+        }
+    }
+    ncps = k + 1;
+    memset(reverse_dirty, 0, 256);
+
+    while (nundo && undo[nundo-1].icount > cp->icount) {
+        struct undo *u = &undo[--nundo];
+        disk_write(u->drive, u->sector, u->data);
+    }
+
+    icount = cp->icount;
+    zp = cp->zp;
+    F = cp->F;
+    curbank = cp->curbank;
+    dma_address = cp->dma_address;
+    drive_number = cp->drive_number;
+    track_number = cp->track_number;
+    sector_number = cp->sector_number;
+    reverse_cursor = cp->cursor;
+    entry = cp->entry;
+    offset = cp->offset;
+    reverse_reason = REVERSE_NONE;
+}
+
+// Runs up to instruction target, unless it stops by itself or is
+// interrupted first.
+
+static void run_to(uint64_t target) {
+    while (icount < target && !reverse_reason && !interrupted) {
+        uint64_t next = cps[ncps-1].icount + interval;
+
+        reverse_next = checkpointing && next < target ? next : target;
+        run_emulator();
+        if (checkpointing && icount >= next)
+            take_checkpoint();
+    }
+}
+
+static void go_to(uint64_t n) {
+    if (n < icount) {
+        int k = ncps - 1;
+        while (k > 0 && cps[k].icount > n)
+            k--;
+        if (n < cps[0].icount) {
+            fprintf(stderr, "the oldest checkpoint is at %llu\n",
+                                        (unsigned long long) cps[0].icount);
+            n = cps[0].icount;
+        }
+        restore(k);
+    }
+    run_to(n);
+}
+
+// From the latest checkpoint back, run up to where the previous search
+// started and watch adr. The first run that sees a write finds the last.
+// When we are right after the write found the last time, the one before.
+
+static int32_t found_adr = -1;
+static uint64_t found_icount;
+
+static void last_write(uint16_t adr) {
+    uint64_t now = icount, end = icount;
+
+    if (adr == found_adr && icount == found_icount)
+        end--;
+    int bdos_break = reverse_bdos_break;
+
+    reverse_watch = adr;
+    reverse_bdos_break = 0;
+    checkpointing = 0;
+    reverse_written = 0;
+    for (int k = ncps - 1; k >= 0 && !reverse_written; k--) {
+        uint64_t start = cps[k].icount;
+        restore(k);
+        run_to(end);
+        end = start;
+    }
+    reverse_watch = -1;
+    reverse_bdos_break = bdos_break;
+    checkpointing = 1;
+
+    if (reverse_written) {
+        fprintf(stderr, "%04X written at instruction %llu by %04X\n", adr,
+                    (unsigned long long) reverse_written, reverse_writer);
+        found_adr = adr;
+        found_icount = reverse_written;
+        go_to(reverse_written);
+    } else {
+        fprintf(stderr, "%04X not written since instruction %llu\n", adr,
+                                        (unsigned long long) cps[0].icount);
+        go_to(now);
+    }
+}
+
+// -------------------------------------------------------------------------
+
+static uint8_t peek(uint16_t adr) {
+    return mem[adr>>14][adr&0x3fff];
+}
+
+static void show_registers(void) {
+    uint16_t pc = (PCH<<8) | PCL;
+    uint8_t op = peek(pc);
+    const char *m = mnemonics[op];
+    const char *sep = m[strlen(m)-1] == ',' ? "" : " ";
+
+    fprintf(stderr, "%llu  %04X  %02X  %s", (unsigned long long) icount, pc,
+                                            op, m);
+    if (modes[op] == MODE_D8)
+        fprintf(stderr, "%s%02XH", sep, peek(pc+1));
+    else if (instruction_length[op] == 3)
+        fprintf(stderr, "%s%02X%02XH", sep, peek(pc+2), peek(pc+1));
+    fprintf(stderr, "\n  A=%02X F=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X "
+                    "SP=%02X%02X\n", A, F, B, C, D, E, H, L, SPH, SPL);
+}
+
+static void show_memory(uint16_t adr, int n) {
+    for (int i=0; i<n; i++) {
+        if (!(i & 15))
+            fprintf(stderr, "%s%04X ", i ? "\n" : "", (uint16_t) (adr+i));
+        fprintf(stderr, " %02X", peek(adr+i));
+    }
+    fprintf(stderr, "\n");
+}
+
+static void show_stop(void) {
+    switch (reverse_reason) {
+    case REVERSE_HLT:
+        fprintf(stderr, "HLT\n");
+        break;
+    case REVERSE_UNDEFINED:
+        fprintf(stderr, "undefined opcode\n");
+        break;
+    case REVERSE_BDOS:
+        fprintf(stderr, "write to the BDOS area by %04X\n", reverse_pc);
+        break;
+    }
+    show_registers();
+}
+
+static void terminal_raw(int raw) {
+    if (terminal)
+        tcsetattr(0, TCSANOW, raw ? &raw_termios : &orig_termios);
+}
+
+static void quit(int sig) {
+    interrupted = 1;
+}
+
+// Returns when the machine should continue
+
+static void debugger(void) {
+    char line[256], cmd[16];
+    unsigned long long x, y;
+
+    terminal_raw(0);
+    fprintf(stderr, "\n");
+    show_stop();
+    interrupted = 0;
+
+    while (1) {
+        fprintf(stderr, "reverse> ");
+        if (!fgets(line, sizeof(line), stdin))
+            exit(0);
+        int n = sscanf(line, "%15s %llx %llx", cmd, &x, &y);
+        if (n < 1)
+            continue;
+        if (n > 1 && strcmp(cmd, "w") && strcmp(cmd, "m"))
+            sscanf(line, "%*s %llu", &x);     // counts are decimal
+        int halted = reverse_reason == REVERSE_HLT
+                  || reverse_reason == REVERSE_UNDEFINED;
+        int forward = !strcmp(cmd, "c") || !strcmp(cmd, "s")
+                   || (!strcmp(cmd, "g") && n > 1 && x > icount);
+        if (forward && halted) {
+            fprintf(stderr, "the machine has stopped, go back first\n");
+            continue;
+        }
+        reverse_reason = REVERSE_NONE;
+
+        if (!strcmp(cmd, "c")) {
+            break;
+        } else if (!strcmp(cmd, "s")) {
+            run_to(icount + (n > 1 ? x : 1));
+            show_stop();
+        } else if (!strcmp(cmd, "b")) {
+            uint64_t back = n > 1 ? x : 1;
+            go_to(back < icount ? icount - back : 0);
+            show_stop();
+        } else if (!strcmp(cmd, "g") && n > 1) {
+            go_to(x);
+            show_stop();
+        } else if (!strcmp(cmd, "w") && n > 1) {
+            last_write(x);
+            show_stop();
+        } else if (!strcmp(cmd, "r")) {
+            show_registers();
+        } else if (!strcmp(cmd, "m") && n > 1) {
+            show_memory(x, n > 2 ? y : 64);
+        } else if (!strcmp(cmd, "q")) {
+            exit(0);
+        } else {
+            fprintf(stderr, "c, s [n], b [n], g n, w adr, r, m adr [n], q\n");
+        }
+    }
+    terminal_raw(1);
+}
+
+int main(int argc, char **argv) {
+    uint64_t stop = UINT64_MAX;
+    const char *disk[2];
+    int i, ndisks = 0;
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-i") && i+1<argc)
+            interval = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-k") && i+1<argc)
+            max_cps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i+1<argc)
+            stop = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-b"))
+            reverse_bdos_break = 1;
+        else if (ndisks < 2)
+            disk[ndisks++] = argv[i];
+        else
+            ndisks = 3;
+    }
+    if (ndisks != 2 || interval < 1 || max_cps < 2) {
+        fprintf(stderr, "usage: atari8080-reverse [-i interval] [-k count] "
+                        "[-s icount] [-b] disk.img disk2.img\n");
+        return 1;
+    }
+
+    if (machine_init(2, disk) < 0)
+        return 1;
+    if (replay_disk || record_disk) {
+        fprintf(stderr, "recorded sectors can't be read twice\n");
+        return 1;
+    }
+    cps = malloc(max_cps * sizeof(*cps));
+    if (!cps) {
+        perror("malloc");
+        return 1;
+    }
+    memset(reverse_dirty, 1, 256);
+    take_checkpoint();
+
+    // raw, but ^\ stops, and ^C goes to CP/M
+
+    terminal = isatty(0) && !replay_file;
+    if (terminal) {
+        tcgetattr(0, &orig_termios);
+        raw_termios = orig_termios;
+        cfmakeraw(&raw_termios);
+        raw_termios.c_lflag |= ISIG;
+        raw_termios.c_cc[VINTR] = _POSIX_VDISABLE;
+        raw_termios.c_cc[VSUSP] = _POSIX_VDISABLE;
+        atexit(reset_terminal_mode);
+        terminal_raw(1);
+    }
+    signal(SIGQUIT, quit);
+
+    while (1) {
+        run_to(stop);
+        if (icount >= stop)
+            stop = UINT64_MAX;
+        fflush(stdout);
+        debugger();
+    }
+}
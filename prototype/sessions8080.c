@@ -0,0 +1,165 @@
+// -------------------------------------------------------------------------
+//
+// sessions8080 - CP/M sessions for several users, on shared drives
+//
+// usage: atari8080-sessions [-n sessions] [-c kB] [-s socket]
+//                           [-f drives] [X=]disk ...
+//
+// Listens on a Unix socket, atari8080.sock by default, and boots a machine
+// of its own for every connection, up to -n at the same time. Connect with
+// e.g. socat -,raw,echo=0 UNIX-CONNECT:atari8080.sock. A session ends at
+// HLT or when the connection is closed.
+//
+// The machine is the static state of atari8080.c, so every session is a
+// forked process: the code and tables are shared, and so are the pages of
+// memory that have CCP, BDOS and BIOS, which the server loads before it
+// forks, until a session writes them. A session costs the pages it writes,
+// at most its 64 kB of memory, and a few pages of state. The drives are the
+// same for all sessions. They read and write image files through one sector
+// cache of -c kB, see cache_read(). %d in the name of a drive is replaced
+// by the session number, to give every session a drive of its own, e.g.
+// B=work%d.img or A=cpm.img+a%d.delta. Other drives than image files are
+// private to a session.
+//
+// CP/M 2.2 is not MP/M: the BDOS of one session does not know what another
+// writes. Sessions can read the same drive at the same time, and a
+// directory that another session changed makes the BDOS set A: or B:
+// read-only until ^C, as it does for a changed floppy. Drives that are
+// written should not be shared.
+//
+// -------------------------------------------------------------------------
+
+#define SESSIONS
+#include "atari8080.c"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define MAXSESSIONS 256
+
+// The name of a drive, with %d replaced by the session number
+
+static const char *session_name(const char *name, int session) {
+    const char *p = strstr(name, "%d");
+    char buf[4096];
+
+    if (!p)
+        return name;
+    snprintf(buf, sizeof(buf), "%.*s%d%s", (int) (p - name), name,
+                                           session, p + 2);
+    return strdup(buf);
+}
+
+static void session(int fd, int number, const char **disks) {
+    const char *names[NDRIVES];
+
+    dup2(fd, 0);
+    dup2(fd, 1);
+    close(fd);
+    setvbuf(stdin, NULL, _IONBF, 0);    // kbhit() looks at the socket
+    for (int i=0; i<NDRIVES; i++)
+        names[i] = disks[i] ? session_name(disks[i], number) : NULL;
+    if (machine_init(NDRIVES, names) < 0) {
+        printf("no session, the drives do not open\r\n");
+        exit(1);
+    }
+    run_emulator();
+    exit(0);
+}
+
+static void child_done(int sig) {
+}
+
+int main(int argc, char **argv) {
+    const char *disks[NDRIVES] = { NULL };
+    const char *path = "atari8080.sock";
+    int next = 0, max = 8, r = 0;
+    long kb = 1024;
+    pid_t pid[MAXSESSIONS] = { 0 };
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-n") && i+1 < argc)
+            max = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c") && i+1 < argc)
+            kb = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i+1 < argc)
+            path = argv[++i];
+        else if (!strcmp(argv[i], "-f") && i+1 < argc)
+            r = drive_file(disks, &next, argv[++i]);
+        else
+            r = drive_arg(disks, &next, argv[i]);
+        if (r < 0)
+            break;
+    }
+    if (r < 0 || !disks[0] || max < 1 || max > MAXSESSIONS || kb < 0) {
+        fprintf(stderr, "usage: atari8080-sessions [-n sessions] [-c kB] "
+                        "[-s socket] [-f drives] [X=]disk ...\n");
+        return 1;
+    }
+
+    uint32_t nslots = 1;
+    while (nslots * 2 * 128 <= kb * 1024)
+        nslots *= 2;
+    if (kb && !(sector_cache = cache_create(nslots))) {
+        perror("mmap");
+        return 1;
+    }
+
+    system_load();                      // shared until a session changes it
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr,
+                                                    sizeof(addr)) < 0
+                     || listen(listener, 16) < 0) {
+        fprintf(stderr, "unable to listen on %s\n", path);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa = { .sa_handler = child_done };  // no SA_RESTART
+    sigaction(SIGCHLD, &sa, NULL);
+    fprintf(stderr, "%d sessions on %s\n", max, path);
+
+    while (1) {
+        int status, n;
+        pid_t done;
+
+        while ((done = waitpid(-1, &status, WNOHANG)) > 0)
+            for (n=0; n<max; n++)
+                if (pid[n] == done)
+                    pid[n] = 0;
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)         // a session ended
+                continue;
+            perror("accept");
+            return 1;
+        }
+        for (n=0; n<max && pid[n]; n++)
+            ;
+        if (n == max) {
+            dprintf(fd, "all %d sessions are in use\r\n", max);
+            close(fd);
+            continue;
+        }
+        pid[n] = fork();
+        if (pid[n] == 0) {
+            close(listener);
+            session(fd, n, disks);
+        }
+        if (pid[n] < 0) {
+            perror("fork");
+            pid[n] = 0;
+        }
+        close(fd);
+        if (sector_cache)
+            fprintf(stderr, "session %d started, cache %llu hits, %llu "
+                            "misses, %llu writes\n", n,
+                    (unsigned long long) sector_cache->hits,
+                    (unsigned long long) sector_cache->misses,
+                    (unsigned long long) sector_cache->writes);
+    }
+}
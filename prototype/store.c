@@ -0,0 +1,251 @@
+// -------------------------------------------------------------------------
+//
+// Content-addressed sector store, for libraries of disk images that are
+// mostly the same. Included by atari8080.c and store8080.c.
+//
+// A store is a directory with two files. blocks holds every different
+// 128-byte sector once, index holds the 64-bit hash of each of them, in
+// the same order. Both are only appended to, under an exclusive lock on
+// index, so any number of emulators can write to the same store. A sector
+// is stored once it is written; sectors that are no longer used stay.
+//
+// An image is a manifest: the header, the path of its store and the block
+// number of each of its sectors. Copying the manifest copies the image.
+// Blocks never change, so they are cached without invalidation.
+//
+// -------------------------------------------------------------------------
+
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define STORE_MAGIC     "atari8080 image"
+#define STORE_CACHE     4096            // blocks, a power of two
+
+struct store_manifest {
+    char magic[16];                     // STORE_MAGIC
+    uint32_t sectors;
+    uint32_t pathlen;                   // followed by the path of the store
+};
+
+struct store {
+    int blocks, index;                  // file descriptors
+    uint32_t nblocks;                   // known so far
+    uint64_t *hash;                     // open addressing, hash+block
+    uint32_t *block;
+    uint32_t size;                      // of the table, a power of two
+    struct { uint32_t block; uint8_t data[128]; } *cache;
+};
+
+static uint64_t store_hash(const uint8_t *data) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+
+    for (int i=0; i<128; i++)
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    return h | 1;                       // 0 is an empty slot
+}
+
+static void store_insert(struct store *s, uint64_t h, uint32_t block) {
+    if (2 * (s->nblocks + 1) > s->size) {
+        uint32_t oldsize = s->size;
+        uint64_t *oldhash = s->hash;
+        uint32_t *oldblock = s->block;
+
+        s->size = s->size ? 2 * s->size : 4096;
+        s->hash = calloc(s->size, sizeof(*s->hash));
+        s->block = calloc(s->size, sizeof(*s->block));
+        if (!s->hash || !s->block) {
+            perror("calloc");
+            exit(1);
+        }
+        for (uint32_t i=0; i<oldsize; i++)
+            if (oldhash[i]) {
+                uint32_t j = oldhash[i] & (s->size - 1);
+                while (s->hash[j])
+                    j = (j + 1) & (s->size - 1);
+                s->hash[j] = oldhash[i];
+                s->block[j] = oldblock[i];
+            }
+        free(oldhash);
+        free(oldblock);
+    }
+    uint32_t j = h & (s->size - 1);
+    while (s->hash[j])
+        j = (j + 1) & (s->size - 1);
+    s->hash[j] = h;
+    s->block[j] = block;
+    s->nblocks++;
+}
+
+// Adds what other writers appended since the last time
+
+static int store_refresh(struct store *s) {
+    uint64_t h[512];
+    ssize_t n;
+
+    while ((n = pread(s->index, h, sizeof(h), s->nblocks * 8ULL)) >= 8)
+        for (int i=0; i<n/8; i++)
+            store_insert(s, h[i], s->nblocks);
+    return n < 0 ? -1 : 0;
+}
+
+static int store_open(struct store *s, const char *dir, int create) {
+    char name[4096];
+
+    memset(s, 0, sizeof(*s));
+    if (create)
+        mkdir(dir, 0777);
+    if (snprintf(name, sizeof(name), "%s/blocks", dir) >= (int) sizeof(name)) {
+        fprintf(stderr, "store name too long: %s\n", dir);
+        return -1;
+    }
+    s->blocks = open(name, O_RDWR | (create ? O_CREAT : 0), 0666);
+    if (snprintf(name, sizeof(name), "%s/index", dir) >= (int) sizeof(name))
+        return -1;                  // not longer than blocks
+    s->index = open(name, O_RDWR | (create ? O_CREAT : 0), 0666);
+    if (s->blocks < 0 || s->index < 0) {
+        fprintf(stderr, "unable to open store %s\n", dir);
+        return -1;
+    }
+    s->cache = malloc(STORE_CACHE * sizeof(*s->cache));
+    if (!s->cache) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i=0; i<STORE_CACHE; i++)
+        s->cache[i].block = UINT32_MAX;
+    return store_refresh(s);
+}
+
+static int store_get(struct store *s, uint32_t block, uint8_t *data) {
+    typeof(*s->cache) *c = &s->cache[block & (STORE_CACHE-1)];
+
+    if (c->block != block) {
+        if (pread(s->blocks, c->data, 128, block * 128ULL) != 128)
+            return -1;
+        c->block = block;
+    }
+    memcpy(data, c->data, 128);
+    return 0;
+}
+
+static int store_find(struct store *s, uint64_t h, const uint8_t *data) {
+    uint8_t old[128];
+
+    if (!s->size)
+        return -1;
+    for (uint32_t j = h & (s->size - 1); s->hash[j]; j = (j + 1) & (s->size - 1))
+        if (s->hash[j] == h && !store_get(s, s->block[j], old)
+                            && !memcmp(old, data, 128))
+            return s->block[j];
+    return -1;
+}
+
+// Returns the block number of data, which is added if it is new, or -1
+
+static int64_t store_put(struct store *s, const uint8_t *data) {
+    uint64_t h = store_hash(data);
+    int64_t block = store_find(s, h, data);
+
+    if (block >= 0)
+        return block;
+
+    flock(s->index, LOCK_EX);
+    if (store_refresh(s) < 0 || (block = store_find(s, h, data)) >= 0) {
+        flock(s->index, LOCK_UN);
+        return block;
+    }
+    block = s->nblocks;
+    if (pwrite(s->blocks, data, 128, block * 128ULL) != 128
+            || pwrite(s->index, &h, 8, block * 8ULL) != 8) {
+        flock(s->index, LOCK_UN);
+        return -1;
+    }
+    store_insert(s, h, block);
+    flock(s->index, LOCK_UN);
+    return block;
+}
+
+// -------------------------------------------------------------------------
+
+struct store_image {
+    int fd;                             // of the manifest
+    struct store store;
+    uint32_t sectors;
+    uint32_t *refs;                     // block of every sector
+    long refs_offset;                   // in the manifest
+};
+
+// Returns 1 if name is a manifest, 0 if it is not, and -1 if it is one
+// that cannot be opened.
+
+static int store_image_open(struct store_image *m, const char *name) {
+    struct store_manifest h;
+    char dir[4096];
+
+    memset(m, 0, sizeof(*m));
+    m->fd = open(name, O_RDWR);
+    if (m->fd < 0)
+        return -1;
+    if (pread(m->fd, &h, sizeof(h), 0) != sizeof(h)
+            || memcmp(h.magic, STORE_MAGIC, sizeof(h.magic))) {
+        close(m->fd);
+        return 0;
+    }
+    if (h.pathlen >= sizeof(dir)
+            || pread(m->fd, dir, h.pathlen, sizeof(h)) != h.pathlen)
+        return -1;
+    dir[h.pathlen] = 0;
+    if (store_open(&m->store, dir, 0) < 0)
+        return -1;
+
+    m->sectors = h.sectors;
+    m->refs_offset = sizeof(h) + h.pathlen;
+    m->refs = malloc(m->sectors * sizeof(*m->refs) + 1);
+    ssize_t n = m->sectors * sizeof(*m->refs);
+    if (!m->refs || pread(m->fd, m->refs, n, m->refs_offset) != n) {
+        fprintf(stderr, "%s is cut short\n", name);
+        return -1;
+    }
+    return 1;
+}
+
+// Like disk_read(), the number of bytes read, 0 beyond the end
+
+static int store_image_read(struct store_image *m, long sector,
+                                                   uint8_t *data) {
+    if (sector >= m->sectors)
+        return 0;
+    return store_get(&m->store, m->refs[sector], data) < 0 ? -1 : 128;
+}
+
+static int store_image_write(struct store_image *m, long sector,
+                                                    const uint8_t *data) {
+    int64_t block = store_put(&m->store, data);
+
+    if (block < 0)
+        return -1;
+    if (sector >= m->sectors) {
+        uint32_t *refs = realloc(m->refs, (sector + 1) * sizeof(*refs));
+        uint8_t empty[128];            // like the hole in an image file
+        int64_t e;
+        memset(empty, 0, 128);
+        if (!refs || (e = store_put(&m->store, empty)) < 0)
+            return -1;
+        m->refs = refs;
+        while (m->sectors < sector) {
+            m->refs[m->sectors] = e;
+            pwrite(m->fd, &m->refs[m->sectors],
+                    4, m->refs_offset + 4L * m->sectors);
+            m->sectors++;
+        }
+        m->sectors++;
+        pwrite(m->fd, &m->sectors, 4, offsetof(struct store_manifest,
+                                                       sectors));
+    }
+    m->refs[sector] = block;
+    if (pwrite(m->fd, &m->refs[sector], 4, m->refs_offset + 4L * sector) != 4)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,126 @@
+// -------------------------------------------------------------------------
+//
+// store8080 - disk images in a content-addressed sector store
+//
+// usage: store8080 import store image.img manifest
+//        store8080 export manifest image.img
+//        store8080 info store
+//
+// import adds the sectors of an image file to the store, which is created
+// if it does not exist, and writes the manifest, which atari8080 runs like
+// an image file. export writes an image file again. See store.c.
+//
+// -------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "store.c"
+
+// The manifest of an image whose sectors are in the store at dir
+
+static int store_image_create(const char *name, const char *dir,
+                              uint32_t sectors, const uint32_t *refs) {
+    struct store_manifest h = { .sectors = sectors, .pathlen = strlen(dir) };
+
+    memcpy(h.magic, STORE_MAGIC, sizeof(h.magic));
+    FILE *f = fopen(name, "wb");
+    if (!f)
+        return -1;
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(dir, 1, h.pathlen, f);
+    fwrite(refs, sizeof(*refs), sectors, f);
+    return fclose(f) ? -1 : 0;
+}
+
+static int import(const char *dir, const char *image, const char *manifest) {
+    struct store s;
+    uint8_t data[128];
+    uint32_t *refs = NULL, n = 0, before;
+    char path[PATH_MAX];
+    size_t len;
+
+    FILE *f = fopen(image, "rb");
+    if (!f) {
+        fprintf(stderr, "unable to open %s\n", image);
+        return 1;
+    }
+    if (store_open(&s, dir, 1) < 0 || !realpath(dir, path))
+        return 1;
+    before = s.nblocks;
+
+    while ((len = fread(data, 1, 128, f)) > 0) {
+        memset(data + len, 0, 128 - len);
+        refs = realloc(refs, (n + 1) * sizeof(*refs));
+        int64_t block = store_put(&s, data);
+        if (!refs || block < 0) {
+            fprintf(stderr, "unable to write to store %s\n", dir);
+            return 1;
+        }
+        refs[n++] = block;
+    }
+    fclose(f);
+
+    if (store_image_create(manifest, path, n, refs) < 0) {
+        fprintf(stderr, "unable to write %s\n", manifest);
+        return 1;
+    }
+    printf("%u sectors, %u new in the store\n", n, s.nblocks - before);
+    return 0;
+}
+
+static int export(const char *manifest, const char *image) {
+    struct store_image m;
+    uint8_t data[128];
+
+    if (store_image_open(&m, manifest) != 1) {
+        fprintf(stderr, "unable to open %s\n", manifest);
+        return 1;
+    }
+    FILE *f = fopen(image, "wb");
+    if (!f) {
+        fprintf(stderr, "unable to create %s\n", image);
+        return 1;
+    }
+    for (uint32_t i=0; i<m.sectors; i++) {
+        if (store_image_read(&m, i, data) != 128) {
+            fprintf(stderr, "block %u of sector %u is missing\n",
+                                                        m.refs[i], i);
+            return 1;
+        }
+        fwrite(data, 1, 128, f);
+    }
+    if (fclose(f)) {
+        fprintf(stderr, "unable to write %s\n", image);
+        return 1;
+    }
+    return 0;
+}
+
+static int info(const char *dir) {
+    struct store s;
+
+    if (store_open(&s, dir, 0) < 0)
+        return 1;
+    printf("%u blocks, %llu bytes\n", s.nblocks,
+                                    (unsigned long long) s.nblocks * 128);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 5 && !strcmp(argv[1], "import"))
+        return import(argv[2], argv[3], argv[4]);
+    if (argc == 4 && !strcmp(argv[1], "export"))
+        return export(argv[2], argv[3]);
+    if (argc == 3 && !strcmp(argv[1], "info"))
+        return info(argv[2]);
+
+    fprintf(stderr, "usage: store8080 import store image.img manifest\n"
+                    "       store8080 export manifest image.img\n"
+                    "       store8080 info store\n");
+    return 1;
+}
@@ -0,0 +1,144 @@
+// C code for every 8080 opcode, with the same semantics as the cases of the
+// switch in run_emulator(), using the same macros. Shared by the code
+// generators. Jumps, calls and returns are written as gotos to the labels in
+// run_emulator(); generators that lay out code differently handle those
+// themselves, based on modes[] and the BRANCH kind.
+
+#include <stdarg.h>
+
+enum {
+    NONE = 0,       // HLT, IN, OUT and undefined, left to the interpreter
+    PURE,           // no memory writes, no jumps
+    WRITE,          // writes to memory
+    BRANCH,         // changes the PC (CALL and RST also write the stack)
+};
+
+static char code[256][256];
+static int kind[256];
+
+static const char *regs[8] = { "B", "C", "D", "E", "H", "L", "M", "A" };
+static const char *rph[4] = { "B", "D", "H", "SPH" };
+static const char *rpl[4] = { "C", "E", "L", "SPL" };
+
+static const char *cond[8] = {
+    "!GET_ZF()", "GET_ZF()", "!GET_CF()", "GET_CF()",
+    "!GET_PF()", "GET_PF()", "!GET_SF()", "GET_SF()"
+};
+
+static void op(int o, int k, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(code[o], sizeof(code[o]), fmt, ap);
+    va_end(ap);
+    kind[o] = k;
+}
+
+// Same semantics as the cases of the switch in run_emulator(), using the
+// same macros.
+
+static void build_snippets(void) {
+    op(0x00, PURE, "");
+    op(0xf3, PURE, "");
+    op(0xfb, PURE, "");
+
+    for (int rp=0; rp<4; rp++) {
+        op(0x01+16*rp, PURE, "LXI(%s,%s);", rph[rp], rpl[rp]);
+        op(0x03+16*rp, PURE, "INX(%s,%s);", rph[rp], rpl[rp]);
+        op(0x09+16*rp, PURE, "DAD(%s,%s);", rph[rp], rpl[rp]);
+        op(0x0b+16*rp, PURE, "DCX(%s,%s);", rph[rp], rpl[rp]);
+    }
+
+    op(0x02, WRITE, "mem_write(C, B, A);");
+    op(0x12, WRITE, "mem_write(E, D, A);");
+    op(0x22, WRITE, "mem_write(byte2, byte3, L); byte2++; "
+                   "if (byte2 == 0) byte3++; mem_write(byte2, byte3, H);");
+    op(0x32, WRITE, "mem_write(byte2, byte3, A);");
+
+    op(0x0a, PURE, "A = mem_read(C, B);");
+    op(0x1a, PURE, "A = mem_read(E, D);");
+    op(0x2a, PURE, "L = mem_read(byte2, byte3); byte2++; "
+                   "if (byte2 == 0) byte3++; H = mem_read(byte2, byte3);");
+    op(0x3a, PURE, "A = mem_read(byte2, byte3);");
+
+    for (int r=0; r<8; r++) {
+        if (r == 6) {
+            op(0x04+8*r, WRITE, "M = mem_read(L, H); INR(M); mem_write(L, H, M);");
+            op(0x05+8*r, WRITE, "M = mem_read(L, H); DCR(M); mem_write(L, H, M);");
+            op(0x06+8*r, WRITE, "mem_write(L, H, byte2);");
+        } else {
+            op(0x04+8*r, PURE, "INR(%s);", regs[r]);
+            op(0x05+8*r, PURE, "DCR(%s);", regs[r]);
+            op(0x06+8*r, PURE, "%s = byte2;", regs[r]);
+        }
+    }
+
+    op(0x07, PURE, "t8 = !!(A & 0x80); A <<= 1; A |= t8; SET_CF(t8);");
+    op(0x0f, PURE, "t8 = A & 1; A >>= 1; A |= t8 ? 0x80 : 0; SET_CF(t8);");
+    op(0x17, PURE, "t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);");
+    op(0x1f, PURE, "t8 = A & 0x01; A >>= 1; A |= GET_CF() ? 0x80 : 0; "
+                   "SET_CF(t8);");
+    op(0x27, PURE, "{ uint8_t save_CF = GET_CF(); t8 = 0; "
+                   "if (daa_table_cond1[A] || GET_AF()) t8 += 0x06; "
+                   "if (daa_table_cond2[A] || GET_CF()) { t8 += 0x60; "
+                   "save_CF = CF_FLAG; } ADD(t8,0); SET_CF(save_CF); }");
+    op(0x2f, PURE, "A = ~A;");
+    op(0x37, PURE, "SET_CF(CF_FLAG);");
+    op(0x3f, PURE, "SET_CF(!GET_CF());");
+
+    for (int d=0; d<8; d++) {
+        for (int s=0; s<8; s++) {
+            int o = 0x40 + 8*d + s;
+            if (o == 0x76)
+                continue;                       // HLT
+            else if (d == s)
+                op(o, PURE, "");
+            else if (s == 6)
+                op(o, PURE, "%s = mem_read(L, H);", regs[d]);
+            else if (d == 6)
+                op(o, WRITE, "mem_write(L, H, %s);", regs[s]);
+            else
+                op(o, PURE, "%s = %s;", regs[d], regs[s]);
+        }
+    }
+
+    static const char *alu[8] = {
+        "ADD(%s,0);", "ADD(%s, GET_CF());", "SUB(%s, 0);", "SUB(%s, GET_CF());",
+        "ANA(%s);", "XRA(%s);", "ORA(%s);", "CMP(%s);"
+    };
+    for (int g=0; g<8; g++) {
+        char buf[64];
+        for (int s=0; s<8; s++) {
+            if (s == 6) {
+                snprintf(buf, sizeof(buf), alu[g], "M");
+                op(0x80+8*g+s, PURE, "M = mem_read(L, H); %s", buf);
+            } else {
+                op(0x80+8*g+s, PURE, alu[g], regs[s]);
+            }
+        }
+        op(0xc6+8*g, PURE, alu[g], "byte2");
+    }
+
+    for (int c=0; c<8; c++) {
+        op(0xc0+8*c, BRANCH, "if (%s) goto RET;", cond[c]);
+        op(0xc2+8*c, BRANCH, "if (%s) goto JMP;", cond[c]);
+        op(0xc4+8*c, BRANCH, "if (%s) goto CALL;", cond[c]);
+        op(0xc7+8*c, BRANCH, "byte2 = 0x%02x; byte3 = 0; goto CALL;", 8*c);
+    }
+    op(0xc9, BRANCH, "goto RET;");
+    op(0xc3, BRANCH, "goto JMP;");
+    op(0xcd, BRANCH, "goto CALL;");
+
+    for (int rp=0; rp<3; rp++) {
+        op(0xc1+16*rp, PURE, "POP(%s,%s);", rph[rp], rpl[rp]);
+        op(0xc5+16*rp, WRITE, "PUSH(%s,%s);", rph[rp], rpl[rp]);
+    }
+    op(0xf1, PURE, "POP(A,F); F |= ONE_FLAG; F &= ALL_FLAGS;");
+    op(0xf5, WRITE, "PUSH(A,F);");
+
+    op(0xe3, WRITE, "t8 = mem_read(SPL, SPH); mem_write(SPL, SPH, L); L = t8; "
+                   "INX(SPH,SPL); t8 = mem_read(SPL, SPH); "
+                   "mem_write(SPL, SPH, H); H = t8; DCX(SPH,SPL);");
+    op(0xeb, PURE, "XCHG();");
+    op(0xe9, BRANCH, "PCHL(); PCHa = PCH & 0x3f; curbank = PCH>>6;");
+    op(0xf9, PURE, "SPHL();");
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Generate fused handlers for frequent opcode sequences (superinstructions)
+//
+// Reads one or more execution profiles written by atari8080-profile and
+// writes superops.h, which is included by atari8080.c when it is built with
+// -DSUPEROPS. Every profile is normalized to its total instruction count, so
+// a long running workload does not drown out the others.
+//
+// usage: superopgen [-p pairs] [-t triples] [-r ratio] profile...
+//
+// Only the last instruction of a sequence may write to memory or change
+// the PC. That way the opcodes we peeked at before executing the sequence
+// can not be changed underneath us, and the fused handler needs no checks.
+
+#include "tables.h"
+#include "snippets.h"
+
+// -------------------------------------------------------------------------
+
+struct seq {
+    uint32_t key;
+    double score;
+};
+
+#define MAXTRIPLES  (1<<20)
+
+static double ops[256];
+static double pairs[256*256];
+static struct seq triples[MAXTRIPLES];
+static int ntriples;
+
+static int cmp_seq(const void *a, const void *b) {
+    const struct seq *x = a, *y = b;
+    if (x->score < y->score) return 1;
+    if (x->score > y->score) return -1;
+    return x->key - y->key;
+}
+
+static int cmp_key(const void *a, const void *b) {
+    const struct seq *x = a, *y = b;
+    return x->key - y->key;
+}
+
+static int read_profile(const char *name) {
+    FILE *f = fopen(name, "r");
+    if (!f) {
+        fprintf(stderr, "superopgen: unable to open %s\n", name);
+        return -1;
+    }
+
+    static double o[256], p[256*256];
+    int first = ntriples;
+    double total = 0;
+    char line[128], what[16];
+    unsigned key;
+    unsigned long long count;
+
+    memset(o, 0, sizeof(o));
+    memset(p, 0, sizeof(p));
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%15s %x %llu", what, &key, &count) != 3)
+            continue;
+        if (!strcmp(what, "op") && key < 256) {
+            o[key] += count;
+            total += count;
+        }
+        else if (!strcmp(what, "pair") && key < 256*256)
+            p[key] += count;
+        else if (!strcmp(what, "triple") && ntriples < MAXTRIPLES)
+            triples[ntriples++] = (struct seq) { key & 0xffffff, count };
+    }
+    fclose(f);
+
+    if (total == 0) {
+        ntriples = first;
+        return 0;
+    }
+    for (int i=0; i<256; i++)
+        ops[i] += o[i] / total;
+    for (int i=0; i<256*256; i++)
+        pairs[i] += p[i] / total;
+    for (int i=first; i<ntriples; i++)
+        triples[i].score /= total;
+    return 0;
+}
+
+// -------------------------------------------------------------------------
+
+static struct seq selp[256*256], selt[4096];
+static int nselp, nselt;
+
+static void print_mnemonic(int o) {
+    const char *m = mnemonics[o];
+    const char *sep = m[strlen(m)-1] == ',' ? "" : " ";
+
+    printf("%s", m);
+    if (modes[o] == MODE_D8) printf("%sn", sep);
+    else if (modes[o] == MODE_D16 || modes[o] == MODE_ADR
+                                  || modes[o] == MODE_JMP) printf("%snn", sep);
+}
+
+static void print_code(const char *indent, int o) {
+    if (code[o][0])
+        printf("%s%s\n", indent, code[o]);
+}
+
+int main(int argc, char **argv) {
+    int maxpairs = 48, maxtriples = 32;
+    double ratio = 0.5;
+    int i;
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "-p") && i+1<argc)
+            maxpairs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i+1<argc)
+            maxtriples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i+1<argc)
+            ratio = atof(argv[++i]);
+        else if (read_profile(argv[i]) < 0)
+            return 1;
+    }
+
+    build_snippets();
+
+    // pick the most frequent sequences that we are able to fuse. Peeking
+    // at the next opcode and not finding a match costs about as much as
+    // we save on a hit, so the sequence must also be the likely successor.
+
+    static struct seq cand[256*256];
+    int n = 0;
+    for (int k=0; k<256*256; k++) {
+        if (pairs[k] > 0 && pairs[k] >= ratio * ops[k>>8]
+                && kind[k>>8] == PURE && kind[k&0xff] != NONE)
+            cand[n++] = (struct seq) { k, pairs[k] };
+    }
+    qsort(cand, n, sizeof(struct seq), cmp_seq);
+    for (i=0; i<n && nselp<maxpairs; i++)
+        selp[nselp++] = cand[i];
+
+    // merge the triples of all profiles
+
+    qsort(triples, ntriples, sizeof(struct seq), cmp_key);
+    n = 0;
+    for (i=0; i<ntriples; i++) {
+        if (n && triples[n-1].key == triples[i].key)
+            triples[n-1].score += triples[i].score;
+        else
+            triples[n++] = triples[i];
+    }
+    ntriples = n;
+
+    static struct seq tcand[MAXTRIPLES];
+    n = 0;
+    for (i=0; i<ntriples; i++) {
+        uint32_t k = triples[i].key;
+        if (triples[i].score >= ratio * pairs[k>>8]
+                && kind[k>>16] == PURE && kind[(k>>8)&0xff] == PURE
+                && kind[k&0xff] != NONE)
+            tcand[n++] = triples[i];
+    }
+    qsort(tcand, n, sizeof(struct seq), cmp_seq);
+    for (i=0; i<n && nselt<maxtriples; i++) {
+        selt[nselt++] = tcand[i];
+
+        // a triple is executed as its pair plus a check for the third
+        // opcode, so the pair must be there, too
+
+        int found = 0;
+        for (int j=0; j<nselp; j++)
+            if (selp[j].key == tcand[i].key>>8) found = 1;
+        if (!found)
+            selp[nselp++] = (struct seq) { tcand[i].key>>8, 0 };
+    }
+
+    // every pair that hits saves one dispatch, a triple saves one more
+
+    double saved = 0, total = 0;
+    for (i=0; i<256; i++)
+        total += ops[i];
+    for (i=0; i<nselp; i++)
+        saved += pairs[selp[i].key];
+    for (i=0; i<nselt; i++)
+        saved += selt[i].score;
+    if (total > 0)
+        fprintf(stderr, "superopgen: %d pairs, %d triples, %.1f%% fewer "
+                        "dispatches\n", nselp, nselt, 100 * saved / total);
+
+    // superop_first[]
+
+    printf("// Generated by superopgen, do not edit.\n\n");
+    printf("#ifdef SUPEROP_TABLE\n\n");
+    printf("static const uint8_t superop_first[256] = {\n");
+    for (int r=0; r<16; r++) {
+        printf("\t");
+        for (int c=0; c<16; c++) {
+            int f = 0;
+            for (int j=0; j<nselp; j++)
+                if (selp[j].key>>8 == r*16+c) f = 1;
+            printf("%d, ", f);
+        }
+        printf("\n");
+    }
+    printf("};\n\n");
+    printf("#else\n\n");
+
+    // handlers, grouped by first opcode, so both levels are dense jump
+    // tables instead of a search through sparse 16-bit keys
+
+    printf("switch (instruction) {\n");
+    for (int a=0; a<256; a++) {
+        int first = 1;
+        for (i=0; i<nselp; i++) {
+            if (selp[i].key>>8 != a)
+                continue;
+            int b = selp[i].key & 0xff;
+
+            if (first) {
+                printf("\ncase 0x%02x:\n", a);
+                printf("    switch (mem[curbank][(PCHa<<8) | PCL]) {\n");
+                first = 0;
+            }
+            printf("    case 0x%02x:        // ", b);
+            print_mnemonic(a);
+            printf(" ; ");
+            print_mnemonic(b);
+            printf("\n");
+            print_code("        ", a);
+            printf("        SUPEROP_FETCH%d();\n", instruction_length[b]);
+            print_code("        ", b);
+
+            int tails = 0;
+            for (int j=0; j<nselt; j++) {
+                if (selt[j].key>>8 != selp[i].key)
+                    continue;
+                int c = selt[j].key & 0xff;
+                if (!tails++)
+                    printf("        switch (mem[curbank][(PCHa<<8) | PCL]) {\n");
+                printf("        case 0x%02x:        // ... ; ", c);
+                print_mnemonic(c);
+                printf("\n");
+                printf("            SUPEROP_FETCH%d();\n",
+                                                instruction_length[c]);
+                print_code("            ", c);
+                printf("            continue;\n");
+            }
+            if (tails)
+                printf("        }\n");
+            printf("        continue;\n");
+        }
+        if (!first)
+            printf("    }\n    goto dispatch;\n");
+    }
+    printf("\ndefault:\n");
+    printf("    goto dispatch;\n");
+    printf("}\n\n");
+    printf("#endif\n");
+
+    return 0;
+}
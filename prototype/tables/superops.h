@@ -0,0 +1,864 @@
+// Generated by superopgen, do not edit.
+
+#ifdef SUPEROP_TABLE
+
+static const uint8_t superop_first[256] = {
+	0, 1, 0, 0, 1, 1, 0, 1, 0, 0, 0, 0, 0, 1, 1, 1, 
+	0, 1, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0, 0, 1, 1, 0, 
+	0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 0, 0, 
+	0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 1, 1, 1, 0, 
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 1, 1, 1, 
+	0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 1, 
+	0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 1, 0, 1, 0, 
+	0, 0, 0, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 1, 0, 1, 1, 0, 0, 0, 1, 0, 1, 0, 0, 0, 
+	0, 1, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 1, 1, 
+	0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 
+	0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 
+};
+
+#else
+
+switch (instruction) {
+
+case 0x01:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x1a:        // LXI B,nn ; LDAX D
+        LXI(B,C);
+        SUPEROP_FETCH1();
+        A = mem_read(E, D);
+        continue;
+    }
+    goto dispatch;
+
+case 0x04:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x0d:        // INR B ; DCR C
+        INR(B);
+        SUPEROP_FETCH1();
+        DCR(C);
+        continue;
+    }
+    goto dispatch;
+
+case 0x05:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc2:        // DCR B ; JNZ nn
+        DCR(B);
+        SUPEROP_FETCH3();
+        if (!GET_ZF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0x07:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xae:        // RLC ; XRA M
+        t8 = !!(A & 0x80); A <<= 1; A |= t8; SET_CF(t8);
+        SUPEROP_FETCH1();
+        M = mem_read(L, H); XRA(M);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x17:        // ... ; RAL
+            SUPEROP_FETCH1();
+            t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x0d:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc2:        // DCR C ; JNZ nn
+        DCR(C);
+        SUPEROP_FETCH3();
+        if (!GET_ZF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0x0e:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xcd:        // MVI C,n ; CALL nn
+        C = byte2;
+        SUPEROP_FETCH3();
+        goto CALL;
+        continue;
+    }
+    goto dispatch;
+
+case 0x0f:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x4f:        // RRC ; MOV C,A
+        t8 = A & 1; A >>= 1; A |= t8 ? 0x80 : 0; SET_CF(t8);
+        SUPEROP_FETCH1();
+        C = A;
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xf1:        // ... ; POP PSW
+            SUPEROP_FETCH1();
+            POP(A,F); F |= ONE_FLAG; F &= ALL_FLAGS;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x11:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x19:        // LXI D,nn ; DAD D
+        LXI(D,E);
+        SUPEROP_FETCH1();
+        DAD(D,E);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x7e:        // ... ; MOV A,M
+            SUPEROP_FETCH1();
+            A = mem_read(L, H);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x13:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x23:        // INX D ; INX H
+        INX(D,E);
+        SUPEROP_FETCH1();
+        INX(H,L);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x0d:        // ... ; DCR C
+            SUPEROP_FETCH1();
+            DCR(C);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x17:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x77:        // RAL ; MOV M,A
+        t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+        SUPEROP_FETCH1();
+        mem_write(L, H, A);
+        continue;
+    case 0x17:        // RAL ; RAL
+        t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+        SUPEROP_FETCH1();
+        t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x21:        // ... ; LXI H,nn
+            SUPEROP_FETCH3();
+            LXI(H,L);
+            continue;
+        }
+        continue;
+    case 0x21:        // RAL ; LXI H,nn
+        t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+        SUPEROP_FETCH3();
+        LXI(H,L);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x7e:        // ... ; MOV A,M
+            SUPEROP_FETCH1();
+            A = mem_read(L, H);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x19:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x7e:        // DAD D ; MOV A,M
+        DAD(D,E);
+        SUPEROP_FETCH1();
+        A = mem_read(L, H);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xfe:        // ... ; CPI n
+            SUPEROP_FETCH2();
+            CMP(byte2);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x1a:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xa8:        // LDAX D ; XRA B
+        A = mem_read(E, D);
+        SUPEROP_FETCH1();
+        XRA(B);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x46:        // ... ; MOV B,M
+            SUPEROP_FETCH1();
+            B = mem_read(L, H);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x1d:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc2:        // DCR E ; JNZ nn
+        DCR(E);
+        SUPEROP_FETCH3();
+        if (!GET_ZF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0x1e:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x0e:        // MVI E,n ; MVI C,n
+        E = byte2;
+        SUPEROP_FETCH2();
+        C = byte2;
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xcd:        // ... ; CALL nn
+            SUPEROP_FETCH3();
+            goto CALL;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x23:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x0d:        // INX H ; DCR C
+        INX(H,L);
+        SUPEROP_FETCH1();
+        DCR(C);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc2:        // ... ; JNZ nn
+            SUPEROP_FETCH3();
+            if (!GET_ZF()) goto JMP;
+            continue;
+        }
+        continue;
+    case 0x7e:        // INX H ; MOV A,M
+        INX(H,L);
+        SUPEROP_FETCH1();
+        A = mem_read(L, H);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x17:        // ... ; RAL
+            SUPEROP_FETCH1();
+            t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+            continue;
+        }
+        continue;
+    case 0x3d:        // INX H ; DCR A
+        INX(H,L);
+        SUPEROP_FETCH1();
+        DCR(A);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc2:        // ... ; JNZ nn
+            SUPEROP_FETCH3();
+            if (!GET_ZF()) goto JMP;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x26:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x29:        // MVI H,n ; DAD H
+        H = byte2;
+        SUPEROP_FETCH1();
+        DAD(H,L);
+        continue;
+    }
+    goto dispatch;
+
+case 0x2a:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x46:        // LHLD nn ; MOV B,M
+        L = mem_read(byte2, byte3); byte2++; if (byte2 == 0) byte3++; H = mem_read(byte2, byte3);
+        SUPEROP_FETCH1();
+        B = mem_read(L, H);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x21:        // ... ; LXI H,nn
+            SUPEROP_FETCH3();
+            LXI(H,L);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x2b:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x71:        // DCX H ; MOV M,C
+        DCX(H,L);
+        SUPEROP_FETCH1();
+        mem_write(L, H, C);
+        continue;
+    }
+    goto dispatch;
+
+case 0x31:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xaf:        // LXI SP,nn ; XRA A
+        LXI(SPH,SPL);
+        SUPEROP_FETCH1();
+        XRA(A);
+        continue;
+    }
+    goto dispatch;
+
+case 0x39:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x22:        // DAD SP ; SHLD nn
+        DAD(SPH,SPL);
+        SUPEROP_FETCH3();
+        mem_write(byte2, byte3, L); byte2++; if (byte2 == 0) byte3++; mem_write(byte2, byte3, H);
+        continue;
+    }
+    goto dispatch;
+
+case 0x3a:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xb7:        // LDA nn ; ORA A
+        A = mem_read(byte2, byte3);
+        SUPEROP_FETCH1();
+        ORA(A);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc2:        // ... ; JNZ nn
+            SUPEROP_FETCH3();
+            if (!GET_ZF()) goto JMP;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x3c:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc2:        // INR A ; JNZ nn
+        INR(A);
+        SUPEROP_FETCH3();
+        if (!GET_ZF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0x3d:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc2:        // DCR A ; JNZ nn
+        DCR(A);
+        SUPEROP_FETCH3();
+        if (!GET_ZF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0x3e:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xdc:        // MVI A,n ; CC nn
+        A = byte2;
+        SUPEROP_FETCH3();
+        if (GET_CF()) goto CALL;
+        continue;
+    }
+    goto dispatch;
+
+case 0x46:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x21:        // MOV B,M ; LXI H,nn
+        B = mem_read(L, H);
+        SUPEROP_FETCH3();
+        LXI(H,L);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x7e:        // ... ; MOV A,M
+            SUPEROP_FETCH1();
+            A = mem_read(L, H);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x4b:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x21:        // MOV C,E ; LXI H,nn
+        C = E;
+        SUPEROP_FETCH3();
+        LXI(H,L);
+        continue;
+    }
+    goto dispatch;
+
+case 0x4d:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xcd:        // MOV C,L ; CALL nn
+        C = L;
+        SUPEROP_FETCH3();
+        goto CALL;
+        continue;
+    }
+    goto dispatch;
+
+case 0x4e:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x11:        // MOV C,M ; LXI D,nn
+        C = mem_read(L, H);
+        SUPEROP_FETCH3();
+        LXI(D,E);
+        continue;
+    }
+    goto dispatch;
+
+case 0x4f:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xf1:        // MOV C,A ; POP PSW
+        C = A;
+        SUPEROP_FETCH1();
+        POP(A,F); F |= ONE_FLAG; F &= ALL_FLAGS;
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x05:        // ... ; DCR B
+            SUPEROP_FETCH1();
+            DCR(B);
+            continue;
+        }
+        continue;
+    case 0x07:        // MOV C,A ; RLC
+        C = A;
+        SUPEROP_FETCH1();
+        t8 = !!(A & 0x80); A <<= 1; A |= t8; SET_CF(t8);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x77:        // ... ; MOV M,A
+            SUPEROP_FETCH1();
+            mem_write(L, H, A);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x56:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x2a:        // MOV D,M ; LHLD nn
+        D = mem_read(L, H);
+        SUPEROP_FETCH3();
+        L = mem_read(byte2, byte3); byte2++; if (byte2 == 0) byte3++; H = mem_read(byte2, byte3);
+        continue;
+    }
+    goto dispatch;
+
+case 0x5e:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x23:        // MOV E,M ; INX H
+        E = mem_read(L, H);
+        SUPEROP_FETCH1();
+        INX(H,L);
+        continue;
+    }
+    goto dispatch;
+
+case 0x5f:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x16:        // MOV E,A ; MVI D,n
+        E = A;
+        SUPEROP_FETCH2();
+        D = byte2;
+        continue;
+    }
+    goto dispatch;
+
+case 0x66:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x6f:        // MOV H,M ; MOV L,A
+        H = mem_read(L, H);
+        SUPEROP_FETCH1();
+        L = A;
+        continue;
+    }
+    goto dispatch;
+
+case 0x67:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc9:        // MOV H,A ; RET
+        H = A;
+        SUPEROP_FETCH1();
+        goto RET;
+        continue;
+    }
+    goto dispatch;
+
+case 0x78:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xa1:        // MOV A,B ; ANA C
+        A = B;
+        SUPEROP_FETCH1();
+        ANA(C);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xe1:        // ... ; POP H
+            SUPEROP_FETCH1();
+            POP(H,L);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x7a:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xbc:        // MOV A,D ; CMP H
+        A = D;
+        SUPEROP_FETCH1();
+        CMP(H);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc0:        // ... ; RNZ
+            SUPEROP_FETCH1();
+            if (!GET_ZF()) goto RET;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x7c:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xb7:        // MOV A,H ; ORA A
+        A = H;
+        SUPEROP_FETCH1();
+        ORA(A);
+        continue;
+    }
+    goto dispatch;
+
+case 0x7e:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x17:        // MOV A,M ; RAL
+        A = mem_read(L, H);
+        SUPEROP_FETCH1();
+        t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x77:        // ... ; MOV M,A
+            SUPEROP_FETCH1();
+            mem_write(L, H, A);
+            continue;
+        }
+        continue;
+    case 0x4f:        // MOV A,M ; MOV C,A
+        A = mem_read(L, H);
+        SUPEROP_FETCH1();
+        C = A;
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x07:        // ... ; RLC
+            SUPEROP_FETCH1();
+            t8 = !!(A & 0x80); A <<= 1; A |= t8; SET_CF(t8);
+            continue;
+        }
+        continue;
+    case 0xfe:        // MOV A,M ; CPI n
+        A = mem_read(L, H);
+        SUPEROP_FETCH2();
+        CMP(byte2);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xca:        // ... ; JZ nn
+            SUPEROP_FETCH3();
+            if (GET_ZF()) goto JMP;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x85:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x6f:        // ADD L ; MOV L,A
+        ADD(L,0);
+        SUPEROP_FETCH1();
+        L = A;
+        continue;
+    }
+    goto dispatch;
+
+case 0x86:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x23:        // ADD M ; INX H
+        M = mem_read(L, H); ADD(M,0);
+        SUPEROP_FETCH1();
+        INX(H,L);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x0d:        // ... ; DCR C
+            SUPEROP_FETCH1();
+            DCR(C);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0x87:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x05:        // ADD A ; DCR B
+        ADD(A,0);
+        SUPEROP_FETCH1();
+        DCR(B);
+        continue;
+    }
+    goto dispatch;
+
+case 0x93:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x78:        // SUB E ; MOV A,B
+        SUB(E, 0);
+        SUPEROP_FETCH1();
+        A = B;
+        continue;
+    }
+    goto dispatch;
+
+case 0x95:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x78:        // SUB L ; MOV A,B
+        SUB(L, 0);
+        SUPEROP_FETCH1();
+        A = B;
+        continue;
+    }
+    goto dispatch;
+
+case 0x96:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xe6:        // SUB M ; ANI n
+        M = mem_read(L, H); SUB(M, 0);
+        SUPEROP_FETCH2();
+        ANA(byte2);
+        continue;
+    }
+    goto dispatch;
+
+case 0x9a:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xd2:        // SBB D ; JNC nn
+        SUB(D, GET_CF());
+        SUPEROP_FETCH3();
+        if (!GET_CF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0x9c:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xda:        // SBB H ; JC nn
+        SUB(H, GET_CF());
+        SUPEROP_FETCH3();
+        if (GET_CF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0xa1:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xe1:        // ANA C ; POP H
+        ANA(C);
+        SUPEROP_FETCH1();
+        POP(H,L);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc1:        // ... ; POP B
+            SUPEROP_FETCH1();
+            POP(B,C);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xa8:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x46:        // XRA B ; MOV B,M
+        XRA(B);
+        SUPEROP_FETCH1();
+        B = mem_read(L, H);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x77:        // ... ; MOV M,A
+            SUPEROP_FETCH1();
+            mem_write(L, H, A);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xa9:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x0f:        // XRA C ; RRC
+        XRA(C);
+        SUPEROP_FETCH1();
+        t8 = A & 1; A >>= 1; A |= t8 ? 0x80 : 0; SET_CF(t8);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x4f:        // ... ; MOV C,A
+            SUPEROP_FETCH1();
+            C = A;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xae:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x17:        // XRA M ; RAL
+        M = mem_read(L, H); XRA(M);
+        SUPEROP_FETCH1();
+        t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x17:        // ... ; RAL
+            SUPEROP_FETCH1();
+            t8 = A & 0x80; A <<= 1; A |= GET_CF(); SET_CF(t8);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xaf:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x32:        // XRA A ; STA nn
+        XRA(A);
+        SUPEROP_FETCH3();
+        mem_write(byte2, byte3, A);
+        continue;
+    }
+    goto dispatch;
+
+case 0xb4:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc9:        // ORA H ; RET
+        ORA(H);
+        SUPEROP_FETCH1();
+        goto RET;
+        continue;
+    }
+    goto dispatch;
+
+case 0xbb:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xca:        // CMP E ; JZ nn
+        CMP(E);
+        SUPEROP_FETCH3();
+        if (GET_ZF()) goto JMP;
+        continue;
+    }
+    goto dispatch;
+
+case 0xbc:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc0:        // CMP H ; RNZ
+        CMP(H);
+        SUPEROP_FETCH1();
+        if (!GET_ZF()) goto RET;
+        continue;
+    }
+    goto dispatch;
+
+case 0xd1:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc1:        // POP D ; POP B
+        POP(D,E);
+        SUPEROP_FETCH1();
+        POP(B,C);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc9:        // ... ; RET
+            SUPEROP_FETCH1();
+            goto RET;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xd6:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xfe:        // SUI n ; CPI n
+        SUB(byte2, 0);
+        SUPEROP_FETCH2();
+        CMP(byte2);
+        continue;
+    }
+    goto dispatch;
+
+case 0xe1:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0xc1:        // POP H ; POP B
+        POP(H,L);
+        SUPEROP_FETCH1();
+        POP(B,C);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc8:        // ... ; RZ
+            SUPEROP_FETCH1();
+            if (GET_ZF()) goto RET;
+            continue;
+        }
+        continue;
+    case 0xd1:        // POP H ; POP D
+        POP(H,L);
+        SUPEROP_FETCH1();
+        POP(D,E);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc1:        // ... ; POP B
+            SUPEROP_FETCH1();
+            POP(B,C);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xeb:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x21:        // XCHG ; LXI H,nn
+        XCHG();
+        SUPEROP_FETCH3();
+        LXI(H,L);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0x19:        // ... ; DAD D
+            SUPEROP_FETCH1();
+            DAD(D,E);
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xf1:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x05:        // POP PSW ; DCR B
+        POP(A,F); F |= ONE_FLAG; F &= ALL_FLAGS;
+        SUPEROP_FETCH1();
+        DCR(B);
+        switch (mem[curbank][(PCHa<<8) | PCL]) {
+        case 0xc2:        // ... ; JNZ nn
+            SUPEROP_FETCH3();
+            if (!GET_ZF()) goto JMP;
+            continue;
+        }
+        continue;
+    }
+    goto dispatch;
+
+case 0xf9:
+    switch (mem[curbank][(PCHa<<8) | PCL]) {
+    case 0x2a:        // SPHL ; LHLD nn
+        SPHL();
+        SUPEROP_FETCH3();
+        L = mem_read(byte2, byte3); byte2++; if (byte2 == 0) byte3++; H = mem_read(byte2, byte3);
+        continue;
+    }
+    goto dispatch;
+
+default:
+    goto dispatch;
+}
+
+#endif
@@ -0,0 +1,221 @@
+static const uint8_t instruction_length[256] = {
+	1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, 
+	1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1, 
+	1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, 
+	1, 3, 3, 1, 1, 1, 2, 1, 1, 1, 3, 1, 1, 1, 2, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1, 
+	1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 1, 2, 1, 
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, 
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1, 
+};
+
+enum addressing_mode {
+    MODE_IMPL = 0,
+    MODE_D8,
+    MODE_D16,
+    MODE_ADR,
+    MODE_JMP,
+    MODE_RST,
+    MODE_RET,
+    MODE_LAST
+};
+
+static const uint8_t modes[256] = {
+	0, 2, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 
+	0, 2, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 
+	0, 2, 3, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 1, 0, 
+	0, 2, 3, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 1, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
+	6, 0, 4, 4, 4, 0, 1, 5, 6, 6, 4, 0, 4, 4, 1, 5, 
+	6, 0, 4, 1, 4, 0, 1, 5, 6, 0, 4, 1, 4, 0, 1, 5, 
+	6, 0, 4, 0, 4, 0, 1, 5, 6, 0, 4, 0, 4, 0, 1, 5, 
+	6, 0, 4, 0, 4, 0, 1, 5, 6, 0, 4, 0, 4, 0, 1, 5, 
+};
+
+static const char const *mnemonics[256] = {
+	"NOP", "LXI B,", "STAX B", "INX B", 
+	"INR B", "DCR B", "MVI B,", "RLC", 
+	"UNDEFINED", "DAD B", "LDAX B", "DCX B", 
+	"INR C", "DCR C", "MVI C,", "RRC", 
+	"UNDEFINED", "LXI D,", "STAX D", "INX D", 
+	"INR D", "DCR D", "MVI D,", "RAL", 
+	"UNDEFINED", "DAD D", "LDAX D", "DCX D", 
+	"INR E", "DCR E", "MVI E,", "RAR", 
+	"UNDEFINED", "LXI H,", "SHLD", "INX H", 
+	"INR H", "DCR H", "MVI H,", "DAA", 
+	"UNDEFINED", "DAD H", "LHLD", "DCX H", 
+	"INR L", "DCR L", "MVI L,", "CMA", 
+	"UNDEFINED", "LXI SP,", "STA", "INX SP", 
+	"INR M", "DCR M", "MVI M,", "STC", 
+	"UNDEFINED", "DAD SP", "LDA", "DCX SP", 
+	"INR A", "DCR A", "MVI A,", "CMC", 
+	"MOV B,B", "MOV B,C", "MOV B,D", "MOV B,E", 
+	"MOV B,H", "MOV B,L", "MOV B,M", "MOV B,A", 
+	"MOV C,B", "MOV C,C", "MOV C,D", "MOV C,E", 
+	"MOV C,H", "MOV C,L", "MOV C,M", "MOV C,A", 
+	"MOV D,B", "MOV D,C", "MOV D,D", "MOV D,E", 
+	"MOV D,H", "MOV D,L", "MOV D,M", "MOV D,A", 
+	"MOV E,B", "MOV E,C", "MOV E,D", "MOV E,E", 
+	"MOV E,H", "MOV E,L", "MOV E,M", "MOV E,A", 
+	"MOV H,B", "MOV H,C", "MOV H,D", "MOV H,E", 
+	"MOV H,H", "MOV H,L", "MOV H,M", "MOV H,A", 
+	"MOV L,B", "MOV L,C", "MOV L,D", "MOV L,E", 
+	"MOV L,H", "MOV L,L", "MOV L,M", "MOV L,A", 
+	"MOV M,B", "MOV M,C", "MOV M,D", "MOV M,E", 
+	"MOV M,H", "MOV M,L", "HLT", "MOV M,A", 
+	"MOV A,B", "MOV A,C", "MOV A,D", "MOV A,E", 
+	"MOV A,H", "MOV A,L", "MOV A,M", "MOV A,A", 
+	"ADD B", "ADD C", "ADD D", "ADD E", 
+	"ADD H", "ADD L", "ADD M", "ADD A", 
+	"ADC B", "ADC C", "ADC D", "ADC E", 
+	"ADC H", "ADC L", "ADC M", "ADC A", 
+	"SUB B", "SUB C", "SUB D", "SUB E", 
+	"SUB H", "SUB L", "SUB M", "SUB A", 
+	"SBB B", "SBB C", "SBB D", "SBB E", 
+	"SBB H", "SBB L", "SBB M", "SBB A", 
+	"ANA B", "ANA C", "ANA D", "ANA E", 
+	"ANA H", "ANA L", "ANA M", "ANA A", 
+	"XRA B", "XRA C", "XRA D", "XRA E", 
+	"XRA H", "XRA L", "XRA M", "XRA A", 
+	"ORA B", "ORA C", "ORA D", "ORA E", 
+	"ORA H", "ORA L", "ORA M", "ORA A", 
+	"CMP B", "CMP C", "CMP D", "CMP E", 
+	"CMP H", "CMP L", "CMP M", "CMP A", 
+	"RNZ", "POP B", "JNZ", "JMP", 
+	"CNZ", "PUSH B", "ADI", "RST 0", 
+	"RZ", "RET", "JZ", "UNDEFINED", 
+	"CZ", "CALL", "ACI", "RST 1", 
+	"RNC", "POP D", "JNC", "OUT", 
+	"CNC", "PUSH D", "SUI", "RST 2", 
+	"RC", "UNDEFINED", "JC", "IN", 
+	"CC", "UNDEFINED", "SBI", "RST 3", 
+	"RPO", "POP H", "JPO", "XTHL", 
+	"CPO", "PUSH H", "ANI", "RST 4", 
+	"RPE", "PCHL", "JPE", "XCHG", 
+	"CPE", "UNDEFINED", "XRI", "RST 5", 
+	"RP", "POP PSW", "JP", "DI", 
+	"CP", "PUSH PSW", "ORI", "RST 6", 
+	"RM", "SPHL", "JM", "EI", 
+	"CM", "UNDEFINED", "CPI", "RST 7", 
+};
+
+static const uint8_t zsp_table[256] = {
+	0x44, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 
+};
+
+static const uint8_t daa_table_cond1[256] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+};
+
+static const uint8_t daa_table_cond2[256] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 
+	0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 
+};
+
@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# End-to-end workload benchmarks.
+#
+# usage: workloads/run.sh [-u] [emulator]       (from the prototype directory)
+#
+# Runs every workload in WORKLOADS on fresh copies of two disk images,
+# with its console input read from workloads/NAME.in, and prints wall
+# time, emulated instructions, BIOS and BDOS calls and disk traffic next
+# to the numbers in workloads/baseline.txt. With -u, the baseline is
+# replaced by this run. The emulator defaults to ./atari8080.
+#
+# The disk images are made with cpmtools, like disk.img in the Makefile.
+#
+# OS3BDOS.ASM is written for MAC, and ASM flags its title line with an N
+# error. ASM skips that line and assembles the rest of it, which is what
+# the asm workload measures.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+WORKLOADS="asm pip zork 8080exm"
+FILES="cpm2-plm/ASM.COM cpm2-plm/PIP.COM cpm2-plm/OS3BDOS.ASM \
+       misc/ZORK1.COM misc/ZORK1.DAT tests/8080EXM.COM utils/halt.COM"
+
+W=workloads
+BASELINE=$W/baseline.txt
+
+update=0
+if [ "$1" = "-u" ]; then
+    update=1
+    shift
+fi
+EMU=${1:-./atari8080}
+
+mkimage() {
+    dd if=/dev/zero of="$1" bs=128 count=8190 2>/dev/null
+    mkfs.cpm -f atarihd "$1"
+}
+
+if [ ! -f $W/disk-a.img ]; then
+    mkimage $W/disk-a.img
+    cpmcp -f atarihd $W/disk-a.img $FILES 0:
+fi
+if [ ! -f $W/disk-b.img ]; then
+    mkimage $W/disk-b.img
+fi
+
+stat() {
+    awk -v k="$2" '$1 == k { print $2 }' "$1"
+}
+
+[ $update = 1 ] && : > $BASELINE.new
+
+printf "%-8s %9s %9s %7s %13s %9s %9s %9s\n" workload seconds baseline \
+        change instructions bios bdos disk_kB
+
+for w in $WORKLOADS; do
+    cp $W/disk-a.img $W/run-a.img
+    cp $W/disk-b.img $W/run-b.img
+
+    ATARI8080_INPUT=$W/$w.in ATARI8080_STATS=$W/$w.stats \
+        $EMU $W/run-a.img $W/run-b.img < /dev/null > $W/$w.out 2>&1
+
+    s=$(stat $W/$w.stats seconds)
+    n=$(stat $W/$w.stats instructions)
+    bios=$(stat $W/$w.stats bios_calls)
+    bdos=$(stat $W/$w.stats bdos_calls)
+    rd=$(stat $W/$w.stats disk_read_bytes)
+    wr=$(stat $W/$w.stats disk_write_bytes)
+    kb=$(( (rd + wr) / 1024 ))
+
+    base= basen=
+    if [ -f $BASELINE ]; then
+        base=$(awk -v w=$w '$1 == w { print $2 }' $BASELINE)
+        basen=$(awk -v w=$w '$1 == w { print $3 }' $BASELINE)
+    fi
+    if [ -n "$base" ]; then
+        change=$(awk -v a=$s -v b=$base 'BEGIN { printf "%+.1f%%", (a-b)*100/b }')
+    else
+        base=-
+        change=-
+    fi
+
+    printf "%-8s %9.3f %9s %7s %13s %9s %9s %9s\n" $w $s $base $change \
+        $n $bios $bdos $kb
+
+    # the same input should always execute the same instructions
+
+    if [ -n "$basen" ] && [ "$basen" != "$n" ]; then
+        echo "$w: executed $n instructions, baseline has $basen"
+    fi
+
+    [ $update = 1 ] && printf "%s %.3f %s %s %s %s %s\n" $w $s $n $bios \
+                                            $bdos $rd $wr >> $BASELINE.new
+done
+
+rm -f $W/run-a.img $W/run-b.img
+
+if [ $update = 1 ]; then
+    mv $BASELINE.new $BASELINE
+    echo "updated $BASELINE"
+fi